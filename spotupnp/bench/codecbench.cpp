@@ -0,0 +1,412 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#include <io.h>
+#define dup _dup
+#define dup2 _dup2
+#define fileno _fileno
+#else
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+#include "Logger.h"
+
+#include "codecs.h"
+
+/****************************************************************************************
+ * Codec benchmark
+ *
+ * Feeds synthetic and recorded PCM through createCodec() the way a player does, but on a
+ * single thread and as fast as possible, then reports for each source and codec setting the
+ * realtime factor (seconds of audio encoded per second), output bytes per second of audio,
+ * time to first encoded byte and peak memory. Results are JSON lines (same fields as the
+ * codec_stats option) or CSV so that they can be compared across releases and platforms.
+ * With -k, sample conversion kernels are measured instead, for every set the CPU can run
+ */
+
+static const char* defaultCodecs[] = { "pcm", "wav", "flac:0", "flac:5", "flac:8", "mp3:128", "mp3:320",
+                                       "aac:160", "aac:256", "vorbis:160", "vorbis:320", "opus:0:5", "opus:0:10" };
+
+struct source {
+    std::string name;
+    std::vector<uint8_t> pcm;
+};
+
+struct measures {
+    double duration = 0, speed = 0, byteRate = 0, latency = 0;
+    uint64_t bytes = 0;
+    size_t peakMemory = 0;
+};
+
+static constexpr double pi = 3.14159265358979323846;
+
+static uint64_t now(void) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/****************************************************************************************
+ * Memory
+ */
+
+// returns current usage (kB) and resets the peak when system allows it
+static size_t startPeak(void) {
+#if defined(__linux__)
+    // writing 5 resets VmHWM to current RSS (since 4.0)
+    if (FILE* file = fopen("/proc/self/clear_refs", "w"); file) {
+        fputs("5", file);
+        fclose(file);
+    }
+    size_t rss = 0;
+    if (FILE* file = fopen("/proc/self/status", "r"); file) {
+        char line[128];
+        while (fgets(line, sizeof(line), file)) if (sscanf(line, "VmRSS: %zu", &rss) == 1) break;
+        fclose(file);
+    }
+    return rss;
+#elif defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize / 1024;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+// peak (kB) since startPeak, elsewhere than Linux this is only the growth of process' peak
+static size_t readPeak(size_t start) {
+    size_t peak = 0;
+#if defined(__linux__)
+    if (FILE* file = fopen("/proc/self/status", "r"); file) {
+        char line[128];
+        while (fgets(line, sizeof(line), file)) if (sscanf(line, "VmHWM: %zu", &peak) == 1) break;
+        fclose(file);
+    }
+#else
+    peak = startPeak();
+#endif
+    return peak > start ? peak - start : 0;
+}
+
+/****************************************************************************************
+ * Sources
+ */
+
+// chord with a slow tremolo, compresses like music
+static source makeTone(uint32_t seconds) {
+    source tone = { "tone" };
+    tone.pcm.resize((size_t) seconds * 44100 * 4);
+    auto samples = (int16_t*) tone.pcm.data();
+    for (size_t i = 0; i < (size_t) seconds * 44100; i++) {
+        double t = i / 44100.0, gain = 0.5 + 0.25 * sin(2 * pi * 0.5 * t);
+        double left = sin(2 * pi * 220 * t) + 0.5 * sin(2 * pi * 277.2 * t) + 0.3 * sin(2 * pi * 329.6 * t);
+        double right = sin(2 * pi * 220 * t + 0.3) + 0.5 * sin(2 * pi * 440 * t) + 0.3 * sin(2 * pi * 659.3 * t);
+        samples[2 * i] = (int16_t) (left / 1.8 * gain * INT16_MAX);
+        samples[2 * i + 1] = (int16_t) (right / 1.8 * gain * INT16_MAX);
+    }
+    return tone;
+}
+
+// white noise at -6 dB, worst case for lossless
+static source makeNoise(uint32_t seconds) {
+    source noise = { "noise" };
+    noise.pcm.resize((size_t) seconds * 44100 * 4);
+    auto samples = (int16_t*) noise.pcm.data();
+    uint32_t seed = 1;
+    for (size_t i = 0; i < (size_t) seconds * 44100 * 2; i++) {
+        seed = seed * 1664525 + 1013904223;
+        samples[i] = (int16_t) (seed >> 16) / 2;
+    }
+    return noise;
+}
+
+// WAV (16 bits, stereo, 44.1 kHz) or raw little-endian PCM in the same format
+static bool loadFile(const char* name, source& file) {
+    FILE* in = fopen(name, "rb");
+    if (!in) return false;
+
+    uint8_t chunk[4096];
+    for (size_t n; (n = fread(chunk, 1, sizeof(chunk), in)) != 0; ) file.pcm.insert(file.pcm.end(), chunk, chunk + n);
+    fclose(in);
+    file.name = name;
+
+    if (file.pcm.size() < 12 || memcmp(file.pcm.data(), "RIFF", 4) || memcmp(file.pcm.data() + 8, "WAVE", 4)) {
+        file.pcm.resize(file.pcm.size() & ~3);
+        return true;
+    }
+
+    // walk chunks, check format and keep only data
+    auto u16 = [](const uint8_t* p) { return (uint32_t) p[0] | p[1] << 8; };
+    auto u32 = [](const uint8_t* p) { return (uint32_t) p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24; };
+    for (size_t pos = 12; pos + 8 <= file.pcm.size(); ) {
+        const uint8_t* p = file.pcm.data() + pos;
+        size_t size = std::min((size_t) u32(p + 4), file.pcm.size() - pos - 8);
+        if (!memcmp(p, "fmt ", 4) && size >= 16) {
+            if (u16(p + 8) != 1 || u16(p + 10) != 2 || u32(p + 12) != 44100 || u16(p + 22) != 16) {
+                fprintf(stderr, "%s must be 16 bits stereo PCM at 44.1kHz\n", name);
+                return false;
+            }
+        } else if (!memcmp(p, "data", 4)) {
+            file.pcm = std::vector<uint8_t>(p + 8, p + 8 + (size & ~3));
+            return true;
+        }
+        pos += 8 + size + (size & 1);
+    }
+
+    fprintf(stderr, "no data in %s\n", name);
+    return false;
+}
+
+/****************************************************************************************
+ * Run
+ */
+
+static measures run(const std::string& codecName, const source& input) {
+    // what cspot sends at once and what the encoder pool asks for at a time
+    const size_t chunk = 16384;
+    std::vector<uint8_t> out(64 * 1024);
+    measures result;
+
+    size_t memory = startPeak();
+    uint64_t start = now();
+
+    codecSettings settings;
+    settings.owner = "bench";
+    auto codec = createCodec(codecName, settings);
+    result.duration = input.pcm.size() / (44100.0 * 4);
+    if (!codec->initialize(result.duration * 1000)) throw std::runtime_error("can't initialize codec");
+
+    for (size_t pos = 0; ; ) {
+        if (pos < input.pcm.size()) {
+            size_t size = std::min(chunk, input.pcm.size() - pos);
+            if (codec->pcmWrite(input.pcm.data() + pos, size)) pos += size;
+        }
+
+        codec->encode(chunk);
+
+        size_t bytes = codec->read(out.data(), out.size());
+        if (bytes && !result.bytes) result.latency = (now() - start) / 1000.0;
+        result.bytes += bytes;
+
+        // all has been received, once drained there is only what remains to read
+        if (pos == input.pcm.size() && !codec->pending() && codec->drain()) break;
+    }
+
+    for (size_t bytes; (bytes = codec->read(out.data(), out.size())) != 0; ) result.bytes += bytes;
+
+    double elapsed = (now() - start) / 1E6;
+    result.speed = elapsed ? result.duration / elapsed : 0;
+    result.byteRate = result.duration ? result.bytes / result.duration : 0;
+    result.peakMemory = readPeak(memory);
+    return result;
+}
+
+/****************************************************************************************
+ * Kernels
+ */
+
+// runs call until it has taken long enough to be measured, returns ns per call
+static double timeCall(const std::function<void(void)>& call) {
+    for (uint64_t count = 16; ; count *= 2) {
+        uint64_t start = now();
+        for (uint64_t i = 0; i < count; i++) call();
+        uint64_t elapsed = now() - start;
+        if (elapsed > 100 * 1000) return elapsed * 1000.0 / count;
+    }
+}
+
+static void runKernels(FILE* out, bool csv, size_t samples) {
+    auto sets = sampleKernels::available();
+    auto input = makeNoise(1);
+    samples = std::min(samples & ~1, input.pcm.size() / 2);
+    auto src = (const int16_t*) input.pcm.data();
+
+    // first set is scalar, others must produce exactly the same
+    std::vector<int32_t> wide(samples), wideRef(samples);
+    std::vector<float> left(samples / 2), right(samples / 2), leftRef(samples / 2), rightRef(samples / 2);
+    std::vector<uint16_t> swapped(samples), swappedRef(samples);
+    const float scale = 1.0f / INT16_MAX;
+    sets[0].widen(src, wideRef.data(), samples);
+    sets[0].deinterleave(src, leftRef.data(), rightRef.data(), samples / 2, scale);
+    memcpy(swappedRef.data(), src, samples * 2);
+    sets[0].byteswap(swappedRef.data(), samples);
+
+    struct kernel {
+        const char* name;
+        std::function<void(const sampleKernels&)> call;
+        std::function<bool(void)> same;
+    } kernels[] = {
+        { "widen", [&](auto& set) { set.widen(src, wide.data(), samples); },
+                   [&] { return wide == wideRef; } },
+        { "deinterleave", [&](auto& set) { set.deinterleave(src, left.data(), right.data(), samples / 2, scale); },
+                          [&] { return left == leftRef && right == rightRef; } },
+        // in-place, so each call swaps back what the previous did
+        { "byteswap", [&](auto& set) { set.byteswap(swapped.data(), samples); },
+                      [&] { return swapped == swappedRef; } },
+    };
+
+    if (csv) fprintf(out, "kernel,kernels,samples,rate,speedup,match\n");
+
+    for (auto& kernel : kernels) {
+        double reference = 0;
+        for (auto& set : sets) {
+            // check output before timing it, byteswap needs a fresh copy
+            memcpy(swapped.data(), src, samples * 2);
+            kernel.call(set);
+            bool match = kernel.same();
+
+            double ns = timeCall([&] { kernel.call(set); });
+            if (!reference) reference = ns;
+            double rate = samples * 1E3 / ns, speedup = ns ? reference / ns : 0;
+
+            if (csv) {
+                fprintf(out, "%s,%s,%zu,%.1f,%.2f,%d\n", kernel.name, set.name, samples, rate, speedup, match);
+            } else {
+                fprintf(out, "{\"kernel\":\"%s\",\"kernels\":\"%s\",\"samples\":%zu,\"rate\":%.1f,\"speedup\":%.2f,"
+                             "\"match\":%s}\n", kernel.name, set.name, samples, rate, speedup, match ? "true" : "false");
+            }
+            fflush(out);
+        }
+    }
+}
+
+static void usage(const char* name) {
+    printf("usage: %s [-o json|csv] [-f <file>] [-t <seconds>] [-r <rounds>] [-i <file>]... [<codec>]...\n"
+           "       %s [-o json|csv] [-f <file>] -k <samples>\n"
+           "  -o    output format, JSON lines (default) or CSV\n"
+           "  -f    write results to file, default is stdout (logs go to stderr)\n"
+           "  -t    duration of synthetic sources in seconds (default 60, 0 for none)\n"
+           "  -r    rounds per run, the fastest is reported (default 3)\n"
+           "  -i    recorded source, WAV or raw PCM 16 bits stereo 44.1kHz (can be repeated)\n"
+           "  -k    measure sample conversion kernels (millions of samples/s) on blocks of <samples>\n"
+           "  codec as in -c option (e.g. flac:5, mp3:320, opus:0:10), default is a set of all\n", name, name);
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> codecs;
+    std::vector<source> sources;
+    bool csv = false;
+    uint32_t seconds = 60, rounds = 3;
+    size_t kernelSamples = 0;
+    const char* outName = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (arg[0] != '-') {
+            codecs.push_back(arg);
+            continue;
+        } else if (i + 1 >= argc || strlen(arg) != 2) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        const char* value = argv[++i];
+        switch (arg[1]) {
+        case 'o': csv = !strcmp(value, "csv"); break;
+        case 'f': outName = value; break;
+        case 't': seconds = atoi(value); break;
+        case 'r': rounds = std::max(1, atoi(value)); break;
+        case 'k': kernelSamples = std::max(2, atoi(value)); break;
+        case 'i': {
+            source file;
+            if (!loadFile(value, file)) {
+                fprintf(stderr, "can't use %s\n", value);
+                return 1;
+            }
+            sources.push_back(std::move(file));
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (codecs.empty()) codecs.assign(std::begin(defaultCodecs), std::end(defaultCodecs));
+    if (seconds && !kernelSamples) {
+        sources.push_back(makeTone(seconds));
+        sources.push_back(makeNoise(seconds));
+    }
+
+    if (sources.empty() && !kernelSamples) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // results on their own stream, stdout is then used by logs
+    FILE* out = outName ? fopen(outName, "w") : fdopen(dup(fileno(stdout)), "w");
+    if (!out) {
+        fprintf(stderr, "can't open %s\n", outName ? outName : "stdout");
+        return 1;
+    }
+    if (!outName) dup2(fileno(stderr), fileno(stdout));
+
+    bell::setDefaultLogger();
+    const char* kernels = sampleKernels::instance().name;
+
+    if (kernelSamples) {
+        runKernels(out, csv, kernelSamples);
+        fclose(out);
+        delete bell::bellGlobalLogger;
+        return 0;
+    }
+
+    if (csv) fprintf(out, "codec,source,duration,speed,byteRate,latency,peakMemory,kernels\n");
+
+    for (auto& input : sources) {
+        for (auto& codec : codecs) {
+            // ogg is Spotify's data forwarded as is, it can't take PCM
+            if (codec.find("ogg") != std::string::npos) {
+                fprintf(stderr, "ogg does not encode PCM, skipped\n");
+                continue;
+            }
+
+            measures best;
+            try {
+                for (uint32_t round = 0; round < rounds; round++) {
+                    auto result = run(codec, input);
+                    if (result.speed > best.speed) best = result;
+                }
+            } catch (const std::exception& e) {
+                fprintf(stderr, "%s on %s failed: %s\n", codec.c_str(), input.name.c_str(), e.what());
+                continue;
+            }
+
+            if (csv) {
+                fprintf(out, "%s,%s,%.3f,%.2f,%.0f,%.3f,%zu,%s\n", codec.c_str(), input.name.c_str(), best.duration,
+                             best.speed, best.byteRate, best.latency, best.peakMemory, kernels);
+            } else {
+                fprintf(out, "{\"codec\":\"%s\",\"source\":\"%s\",\"duration\":%.3f,\"speed\":%.2f,\"byteRate\":%.0f,"
+                             "\"latency\":%.3f,\"peakMemory\":%zu,\"kernels\":\"%s\"}\n", codec.c_str(), input.name.c_str(),
+                             best.duration, best.speed, best.byteRate, best.latency, best.peakMemory, kernels);
+            }
+            fflush(out);
+        }
+    }
+
+    fclose(out);
+    delete bell::bellGlobalLogger;
+    return 0;
+}
@@ -0,0 +1,199 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include "HTTPparser.h"
+
+/****************************************************************************************
+ * HTTP parser benchmark and fuzz target
+ *
+ * The fuzz entry point parses its input at once and then fed in growing pieces the way the
+ * reactor receives it, and aborts when results differ or when a view points outside of the
+ * data. Built with PARSER_FUZZ, libFuzzer provides main(), otherwise main() runs requests
+ * recorded from renderers (and files given as arguments) through the parser and the lookups
+ * a streamer does, and reports requests and bytes parsed per second
+ */
+
+static const char* recorded[] = {
+    // Sonos
+    "GET /spotupnp.flac?id=12345678 HTTP/1.1\r\n"
+    "CONNECTION: close\r\n"
+    "HOST: 192.168.1.10:49152\r\n"
+    "USER-AGENT: Linux UPnP/1.0 Sonos/79.1-52294 (ZPS23)\r\n"
+    "X-SONOS-TARGET-DEVICE: RINCON_48A6B8F0E0A001400\r\n"
+    "Icy-MetaData: 1\r\n"
+    "\r\n",
+    // VLC seeking with range
+    "GET /spotupnp.mp3?id=12345678 HTTP/1.1\r\n"
+    "Host: 192.168.1.10:49152\r\n"
+    "Accept: */*\r\n"
+    "Accept-Language: en_US\r\n"
+    "User-Agent: VLC/3.0.20 LibVLC/3.0.20\r\n"
+    "Range: bytes=1048576-\r\n"
+    "\r\n",
+    // DLNA renderer with time seek and bare LF
+    "GET /spotupnp.wav?id=12345678 HTTP/1.0\n"
+    "Host: 192.168.1.10:49152\n"
+    "User-Agent: DLNADOC/1.50 UPnP/1.0 Platinum/1.0.5.13\n"
+    "transferMode.dlna.org: Streaming\n"
+    "getcontentFeatures.dlna.org: 1\n"
+    "getAvailableSeekRange.dlna.org: 1\n"
+    "TimeSeekRange.dlna.org: npt=0:01:30.000-\n"
+    "\n",
+    // HEAD probe
+    "HEAD /spotupnp.aac?id=12345678 HTTP/1.1\r\n"
+    "Host: 192.168.1.10:49152\r\n"
+    "User-Agent: BubbleUPnP UPnP/1.1\r\n"
+    "Accept-Encoding: identity\r\n"
+    "\r\n",
+};
+
+static void check(bool condition, const char* what) {
+    if (condition) return;
+    fprintf(stderr, "parser check failed: %s\n", what);
+    abort();
+}
+
+static bool within(std::string_view view, std::string_view data) {
+    return !view.data() || (view.data() >= data.data() && view.data() + view.size() <= data.data() + data.size());
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    std::string_view input((const char*) data, size);
+    HTTPparser whole, pieces;
+    auto status = whole.parse(input);
+
+    if (status == HTTPparser::COMPLETE) {
+        check(within(whole.method, input) && within(whole.target, input) && within(whole.version, input), "request line");
+        for (auto& field : whole) check(within(field.name, input) && within(field.value, input), "field");
+        check(within(whole.query("id"), input) && within(whole.header("range"), input), "lookup");
+    } else {
+        check(status == HTTPparser::INVALID || size <= HTTPparser::maxSize, "incomplete beyond maximum size");
+    }
+
+    // first byte sets the size of pieces so that all splits are tried over the corpus
+    size_t step = size ? data[0] % 64 + 1 : 1, len = 0;
+    auto progress = HTTPparser::INCOMPLETE;
+    while (progress == HTTPparser::INCOMPLETE && len < size) {
+        len = std::min(len + step, size);
+        progress = pieces.parse(input.substr(0, len));
+    }
+
+    // a prefix can be refused for its size before the end is found in whole data
+    if (progress == HTTPparser::INVALID && status == HTTPparser::COMPLETE && len > HTTPparser::maxSize) return 0;
+
+    check(progress == status, "status");
+    if (status != HTTPparser::COMPLETE) return 0;
+
+    check(whole.method == pieces.method && whole.target == pieces.target && whole.version == pieces.version, "request line");
+    check(std::equal(whole.begin(), whole.end(), pieces.begin(), pieces.end(), [](auto& a, auto& b) {
+        return a.name == b.name && a.value == b.value;
+    }), "fields");
+
+    return 0;
+}
+
+#ifndef PARSER_FUZZ
+static uint64_t now(void) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool loadFile(const char* name, std::vector<std::string>& requests) {
+    FILE* file = fopen(name, "rb");
+    if (!file) return false;
+
+    std::string request;
+    char buffer[4096];
+    for (size_t n; (n = fread(buffer, 1, sizeof(buffer), file)) > 0; ) request.append(buffer, n);
+    fclose(file);
+
+    requests.push_back(std::move(request));
+    return true;
+}
+
+static void usage(const char* name) {
+    printf("%s [-r <rounds>] [-p <piece size>] [file]...\n"
+           "  -r <rounds>\t\tnumber of passes over all requests (default 1000000)\n"
+           "  -p <piece size>\tfeed requests by pieces of that size, like partial receives (default whole)\n"
+           "  file\t\t\trecorded request(s) to use instead of built-in ones\n", name);
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> requests;
+    size_t rounds = 1000000, piece = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (arg[0] != '-') {
+            if (!loadFile(arg, requests)) {
+                fprintf(stderr, "can't use %s\n", arg);
+                return 1;
+            }
+            continue;
+        } else if (i + 1 >= argc || strlen(arg) != 2) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        const char* value = argv[++i];
+        switch (arg[1]) {
+        case 'r': rounds = std::max(1, atoi(value)); break;
+        case 'p': piece = std::max(0, atoi(value)); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (requests.empty()) requests.assign(std::begin(recorded), std::end(recorded));
+
+    // same checks as fuzzing, so that recorded requests are known to be parsed right
+    size_t bytes = 0, complete = 0, found = 0;
+    for (auto& request : requests) {
+        LLVMFuzzerTestOneInput((const uint8_t*) request.data(), request.size());
+        bytes += request.size();
+    }
+
+    HTTPparser parser;
+    uint64_t start = now();
+
+    for (size_t round = 0; round < rounds; round++) {
+        for (auto& request : requests) {
+            std::string_view data = request;
+            auto status = HTTPparser::INCOMPLETE;
+            parser.reset();
+
+            if (!piece) status = parser.parse(data);
+            else for (size_t len = 0; status == HTTPparser::INCOMPLETE && len < data.size(); ) {
+                len = std::min(len + piece, data.size());
+                status = parser.parse(data.substr(0, len));
+            }
+
+            if (status != HTTPparser::COMPLETE) continue;
+            complete++;
+
+            // what a streamer looks for in every request
+            found += parser.query("id").size() + HTTPparser::contains(parser.header("user-agent"), "sonos") +
+                     parser.has("icy-metadata") + parser.has("transferMode.dlna.org") +
+                     parser.has("TimeSeekRange.dlna.org") + parser.header("range").size();
+        }
+    }
+
+    double elapsed = (now() - start) / 1e9;
+    double count = (double) rounds * requests.size();
+    printf("{\"requests\":%zu,\"complete\":%zu,\"found\":%zu,\"piece\":%zu,\"elapsed\":%.3f,\"rate\":%.0f,\"byteRate\":%.0f,\"latency\":%.1f}\n",
+           requests.size(), complete, found, piece, elapsed, count / elapsed, rounds * bytes / elapsed, elapsed * 1e9 / count);
+
+    return 0;
+}
+#endif
@@ -10,7 +10,7 @@
 extern "C" {
 #endif
 
-enum { HTTP_CL_CHUNKED = -3, HTTP_CL_KNOWN = -2, HTTP_CL_NONE = -1, HTTP_CL_REAL = 0 };
+enum { HTTP_CL_EXACT = -4, HTTP_CL_CHUNKED = -3, HTTP_CL_KNOWN = -2, HTTP_CL_NONE = -1, HTTP_CL_REAL = 0 };
 
 /* Mode 0 works the best because it is still in memory and lasts forever because there 
  * are very little risks that a player request super old ranges (over 8MB) so it's 
@@ -19,7 +19,7 @@ enum { HTTP_CL_CHUNKED = -3, HTTP_CL_KNOWN = -2, HTTP_CL_NONE = -1, HTTP_CL_REAL
 
 enum { HTTP_CACHE_MEM = 0, HTTP_CACHE_INFINITE, HTTP_CACHE_DISK };
 
-char* makeDLNA_ORG(const char* codec, bool fullCache, bool live);
+char* makeDLNA_ORG(const char* codec, bool fullCache, bool live, bool paced);
 
 #define HTTP_BASE_URL "/spotupnp"
 
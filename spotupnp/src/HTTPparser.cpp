@@ -0,0 +1,124 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+
+#include "HTTPparser.h"
+
+/****************************************************************************************
+ * Parser
+ */
+
+static std::string_view trim(std::string_view data) {
+    while (!data.empty() && (data.front() == ' ' || data.front() == '\t')) data.remove_prefix(1);
+    while (!data.empty() && (data.back() == ' ' || data.back() == '\t' || data.back() == '\r')) data.remove_suffix(1);
+    return data;
+}
+
+bool HTTPparser::equals(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+        return tolower((unsigned char) x) == tolower((unsigned char) y);
+    });
+}
+
+bool HTTPparser::contains(std::string_view haystack, std::string_view needle) {
+    return std::search(haystack.begin(), haystack.end(), needle.begin(), needle.end(), [](char x, char y) {
+        return tolower((unsigned char) x) == tolower((unsigned char) y);
+    }) != haystack.end();
+}
+
+HTTPparser::status HTTPparser::parse(std::string_view data) {
+    // only look at new data for end of headers (blank line), tolerating bare LF
+    size_t end = std::string_view::npos;
+    for (size_t i = scanned > 3 ? scanned - 3 : 0; i < data.size() && end == std::string_view::npos; i++) {
+        if (data[i] != '\n') continue;
+        if (i >= 1 && data[i - 1] == '\n') end = i + 1;
+        else if (i >= 3 && data[i - 1] == '\r' && data[i - 2] == '\n') end = i + 1;
+    }
+
+    if (end == std::string_view::npos) {
+        scanned = data.size();
+        return data.size() > maxSize ? INVALID : INCOMPLETE;
+    }
+
+    data = data.substr(0, end);
+    count = 0;
+
+    // request line is <method> SP <target> SP <version>
+    size_t eol = data.find('\n');
+    std::string_view line = trim(data.substr(0, eol));
+    size_t sp1 = line.find(' '), sp2 = line.rfind(' ');
+    if (sp1 == std::string_view::npos || sp1 == sp2) return INVALID;
+
+    method = line.substr(0, sp1);
+    target = trim(line.substr(sp1 + 1, sp2 - sp1 - 1));
+    version = line.substr(sp2 + 1);
+
+    // then headers up to the blank line, extra ones are ignored
+    for (size_t pos = eol + 1; pos < data.size(); pos = eol + 1) {
+        eol = data.find('\n', pos);
+        line = data.substr(pos, eol - pos);
+        if (trim(line).empty()) break;
+
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos || count == fields.size()) continue;
+        fields[count++] = { trim(line.substr(0, colon)), trim(line.substr(colon + 1)) };
+    }
+
+    return COMPLETE;
+}
+
+std::string_view HTTPparser::header(std::string_view name) const {
+    for (auto& field : *this) if (equals(field.name, name)) return field.value;
+    return {};
+}
+
+std::string_view HTTPparser::query(std::string_view key) const {
+    size_t pos = target.find('?');
+    std::string_view items = pos == std::string_view::npos ? std::string_view() : target.substr(pos + 1);
+
+    while (!items.empty()) {
+        std::string_view item = items.substr(0, items.find('&'));
+        items.remove_prefix(std::min(item.size() + 1, items.size()));
+        if (item.size() > key.size() && item[key.size()] == '=' && item.substr(0, key.size()) == key) {
+            return item.substr(key.size() + 1);
+        }
+    }
+
+    return {};
+}
+
+/****************************************************************************************
+ * Writer
+ */
+
+HTTPwriter& HTTPwriter::line(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buffer.data() + len, buffer.size() - len, format, args);
+    va_end(args);
+
+    // need room for CRLF as well
+    if (n >= 0 && len + n + 2 <= buffer.size()) {
+        len += n;
+        buffer[len++] = '\r';
+        buffer[len++] = '\n';
+    }
+
+    return *this;
+}
+
+HTTPwriter& HTTPwriter::append(std::string_view data) {
+    if (len + data.size() <= buffer.size()) {
+        memcpy(buffer.data() + len, data.data(), data.size());
+        len += data.size();
+    }
+    return *this;
+}
@@ -0,0 +1,62 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <string_view>
+#include <inttypes.h>
+
+/****************************************************************************************
+ * HTTP/1.x request parser
+ *
+ * Works in-place on the received data, so that fields are views that are valid as long as
+ * that data is. Parsing can be called each time new data arrives and only new bytes are
+ * scanned until the end of headers is found. There is no allocation.
+ */
+class HTTPparser {
+public:
+    enum status { INCOMPLETE, COMPLETE, INVALID };
+    struct field {
+        std::string_view name, value;
+    };
+
+private:
+    size_t scanned = 0;
+    size_t count = 0;
+    std::array<field, 32> fields;
+
+public:
+    static constexpr size_t maxSize = 8192;
+    std::string_view method, target, version;
+
+    status parse(std::string_view data);
+    void reset(void) { scanned = count = 0; }
+    std::string_view header(std::string_view name) const;
+    bool has(std::string_view name) const { return header(name).data() != nullptr; }
+    std::string_view query(std::string_view key) const;
+    const field* begin(void) const { return fields.data(); }
+    const field* end(void) const { return fields.data() + count; }
+    static bool equals(std::string_view a, std::string_view b);
+    static bool contains(std::string_view haystack, std::string_view needle);
+};
+
+/****************************************************************************************
+ * HTTP/1.x response writer
+ *
+ * Formats status and header lines in a fixed buffer, lines that do not fit are dropped
+ */
+class HTTPwriter {
+private:
+    std::array<char, 2048> buffer;
+    size_t len = 0;
+
+public:
+    void clear(void) { len = 0; }
+    HTTPwriter& line(const char* format, ...);
+    HTTPwriter& append(std::string_view data);
+    std::string_view view(void) const { return { buffer.data(), len }; }
+};
@@ -0,0 +1,298 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define poll WSAPoll
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#define closesocket(s) close(s)
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#include "Logger.h"
+
+#include "HTTPreactor.h"
+
+static uint64_t now_ms(void) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/****************************************************************************************
+ * Creation / deletion
+ */
+
+HTTPreactor::HTTPreactor(size_t count) {
+#ifdef __linux__
+    pollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pollFd < 0 || wakeFd < 0) throw std::runtime_error("can't create epoll " + std::string(strerror(errno)));
+    struct epoll_event event = { };
+    event.events = EPOLLIN;
+    event.data.fd = wakeFd;
+    epoll_ctl(pollFd, EPOLL_CTL_ADD, wakeFd, &event);
+#else
+    // a loopback UDP socket talking to itself is the most portable way to interrupt poll()
+    struct sockaddr_in addr = { };
+    socklen_t len = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    wakeFd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (wakeFd < 0 || bind(wakeFd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+        getsockname(wakeFd, (struct sockaddr*) &addr, &len) < 0 ||
+        ::connect(wakeFd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        throw std::runtime_error("can't create reactor's wake socket");
+    }
+    setNonBlocking(wakeFd);
+#endif
+    poller = std::thread(&HTTPreactor::pollTask, this);
+    for (size_t i = 0; i < std::max(count, (size_t) 1); i++) workers.emplace_back(&HTTPreactor::workerTask, this);
+    CSPOT_LOG(info, "HTTP reactor started with %zu workers", workers.size());
+}
+
+HTTPreactor::~HTTPreactor() {
+    isRunning = false;
+    wakeup();
+    workCond.notify_all();
+    poller.join();
+    for (auto& worker : workers) worker.join();
+    if (pollFd >= 0) closesocket(pollFd);
+    closesocket(wakeFd);
+}
+
+HTTPreactor& HTTPreactor::instance(void) {
+    static HTTPreactor reactor(workerCount);
+    return reactor;
+}
+
+bool HTTPreactor::setNonBlocking(int sock) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    return flags >= 0 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+/****************************************************************************************
+ * Sources management
+ */
+
+void HTTPreactor::add(int sock, eventHandler handler) {
+    std::scoped_lock lock(mutex);
+    sources[sock] = std::make_shared<source>(sock, handler);
+#ifdef __linux__
+    // registered but disabled until armed
+    struct epoll_event event = { };
+    event.events = EPOLLONESHOT;
+    event.data.fd = sock;
+    if (epoll_ctl(pollFd, EPOLL_CTL_ADD, sock, &event) < 0 && errno == EEXIST) epoll_ctl(pollFd, EPOLL_CTL_MOD, sock, &event);
+#endif
+}
+
+void HTTPreactor::arm(int sock, int events, int timeout) {
+    std::scoped_lock lock(mutex);
+    auto it = sources.find(sock);
+    if (it == sources.end()) return;
+    auto s = it->second;
+
+    disarm(s.get());
+    s->armed = events & (READ | WRITE);
+    bool wake = false;
+
+    if (timeout >= 0) {
+        s->deadline = now_ms() + timeout;
+        // only need to interrupt poller if that's our new closest deadline
+        wake = timers.empty() || s->deadline < timers.begin()->first;
+        timers.emplace(s->deadline, sock);
+    }
+
+#ifdef __linux__
+    if (s->armed) {
+        struct epoll_event event = { };
+        event.events = EPOLLONESHOT | ((s->armed & READ) ? (uint32_t) EPOLLIN : 0u) | ((s->armed & WRITE) ? (uint32_t) EPOLLOUT : 0u);
+        event.data.fd = sock;
+        epoll_ctl(pollFd, EPOLL_CTL_MOD, sock, &event);
+    }
+#else
+    // poll() set has to be rebuilt
+    wake = true;
+#endif
+
+    if (wake) wakeup();
+}
+
+void HTTPreactor::notify(int sock) {
+    // does not need the poller, several notifications before handler runs make one call
+    std::scoped_lock lock(mutex);
+    if (auto it = sources.find(sock); it != sources.end()) dispatch(it->second, NOTIFY);
+}
+
+void HTTPreactor::remove(int sock) {
+    std::unique_lock lock(mutex);
+    auto it = sources.find(sock);
+    if (it == sources.end()) return;
+    auto s = it->second;
+
+    disarm(s.get());
+    s->removed = true;
+    sources.erase(it);
+#ifdef __linux__
+    epoll_ctl(pollFd, EPOLL_CTL_DEL, sock, NULL);
+#else
+    wakeup();
+#endif
+
+    // wait for any handler in progress unless we are that handler
+    if (current != s.get()) idleCond.wait(lock, [&s] { return !s->running; });
+}
+
+void HTTPreactor::disarm(source* s) {
+    // mutex must be locked
+    if (s->deadline) timers.erase({ s->deadline, s->sock });
+#ifdef __linux__
+    // oneshot means that it's already disabled if it has fired
+    if (s->armed) {
+        struct epoll_event event = { };
+        event.events = EPOLLONESHOT;
+        event.data.fd = s->sock;
+        epoll_ctl(pollFd, EPOLL_CTL_MOD, s->sock, &event);
+    }
+#endif
+    s->deadline = 0;
+    s->armed = NONE;
+}
+
+void HTTPreactor::dispatch(std::shared_ptr<source>& s, int events) {
+    // mutex must be locked
+    disarm(s.get());
+    s->fired |= events;
+    // a running handler will be re-invoked by its worker
+    if (s->running) return;
+    s->running = true;
+    jobs.push_back(s);
+    workCond.notify_one();
+}
+
+void HTTPreactor::wakeup(void) {
+#ifdef __linux__
+    uint64_t one = 1;
+    (void) !write(wakeFd, &one, sizeof(one));
+#else
+    send(wakeFd, "", 1, 0);
+#endif
+}
+
+/****************************************************************************************
+ * Threads
+ */
+
+void HTTPreactor::pollTask(void) {
+    while (isRunning) {
+        int timeout = -1;
+
+        std::unique_lock lock(mutex);
+        if (!timers.empty()) {
+            uint64_t now = now_ms();
+            timeout = timers.begin()->first > now ? timers.begin()->first - now : 0;
+        }
+
+#ifdef __linux__
+        lock.unlock();
+        struct epoll_event events[64];
+        int n = epoll_wait(pollFd, events, 64, timeout);
+        lock.lock();
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == wakeFd) {
+                uint64_t count;
+                (void) !read(wakeFd, &count, sizeof(count));
+                continue;
+            }
+            auto it = sources.find(events[i].data.fd);
+            if (it == sources.end() || !it->second->armed) continue;
+            // errors and hangups are left to be discovered by recv/send
+            int fired = events[i].events & (EPOLLERR | EPOLLHUP) ? it->second->armed : NONE;
+            if (events[i].events & EPOLLIN) fired |= READ;
+            if (events[i].events & EPOLLOUT) fired |= WRITE;
+            dispatch(it->second, fired & it->second->armed);
+        }
+#else
+        std::vector<struct pollfd> fds = { { (decltype(pollfd::fd)) wakeFd, POLLIN, 0 } };
+        for (auto& [sock, s] : sources) {
+            if (!s->armed) continue;
+            fds.push_back({ (decltype(pollfd::fd)) sock, (short) ((s->armed & READ ? POLLIN : 0) | (s->armed & WRITE ? POLLOUT : 0)), 0 });
+        }
+
+        lock.unlock();
+        int n = poll(fds.data(), fds.size(), timeout);
+        lock.lock();
+
+        if (n > 0 && fds[0].revents) {
+            char buffer[16];
+            while (recv(wakeFd, buffer, sizeof(buffer), 0) > 0);
+        }
+
+        for (size_t i = 1; n > 0 && i < fds.size(); i++) {
+            if (!fds[i].revents) continue;
+            auto it = sources.find((int) fds[i].fd);
+            if (it == sources.end() || !it->second->armed) continue;
+            int fired = fds[i].revents & (POLLERR | POLLHUP | POLLNVAL) ? it->second->armed : NONE;
+            if (fds[i].revents & POLLIN) fired |= READ;
+            if (fds[i].revents & POLLOUT) fired |= WRITE;
+            dispatch(it->second, fired & it->second->armed);
+        }
+#endif
+
+        // now process expired timers
+        for (uint64_t now = now_ms(); !timers.empty() && timers.begin()->first <= now;) {
+            auto it = sources.find(timers.begin()->second);
+            if (it != sources.end()) dispatch(it->second, TIMEOUT);
+            else timers.erase(timers.begin());
+        }
+    }
+}
+
+void HTTPreactor::workerTask(void) {
+    std::unique_lock lock(mutex);
+
+    while (isRunning) {
+        workCond.wait(lock, [this] { return !jobs.empty() || !isRunning; });
+        if (!isRunning) break;
+
+        auto s = jobs.front();
+        jobs.pop_front();
+
+        // events fired while handler was running are served right away by the same worker
+        while (s->fired && !s->removed) {
+            int events = s->fired;
+            s->fired = NONE;
+            current = s.get();
+            lock.unlock();
+            s->handler(events);
+            lock.lock();
+            current = nullptr;
+        }
+
+        s->running = false;
+        s->fired = NONE;
+        idleCond.notify_all();
+    }
+}
@@ -0,0 +1,73 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <inttypes.h>
+
+/****************************************************************************************
+ * Reactor owning the sockets of all HTTP streamers
+ *
+ * One thread waits for socket events (epoll on Linux, poll elsewhere) and timeouts, then
+ * hands them over to a small pool of workers. Sockets are armed for a single event (oneshot)
+ * so that a handler is never re-entered for the same socket and it must re-arm it when it
+ * wants to be called again. When nothing is armed with a timeout, nothing wakes up. Producers
+ * of data can also notify a socket so that its handler is called as soon as possible.
+ */
+class HTTPreactor {
+public:
+    enum { NONE = 0, READ = 0x01, WRITE = 0x02, TIMEOUT = 0x04, NOTIFY = 0x08 };
+    typedef std::function<void(int events)> eventHandler;
+
+private:
+    struct source {
+        int sock;
+        eventHandler handler;
+        int armed = NONE, fired = NONE;
+        bool running = false, removed = false;
+        uint64_t deadline = 0;
+        source(int sock, eventHandler handler) : sock(sock), handler(handler) { }
+    };
+
+    std::mutex mutex;
+    std::condition_variable workCond, idleCond;
+    std::map<int, std::shared_ptr<source>> sources;
+    std::set<std::pair<uint64_t, int>> timers;
+    std::deque<std::shared_ptr<source>> jobs;
+    std::vector<std::thread> workers;
+    std::thread poller;
+    std::atomic<bool> isRunning = true;
+    int pollFd = -1, wakeFd = -1;
+    inline static thread_local source* current = nullptr;
+
+    void pollTask(void);
+    void workerTask(void);
+    void disarm(source* s);
+    void dispatch(std::shared_ptr<source>& s, int events);
+    void wakeup(void);
+
+public:
+    inline static size_t workerCount = 2;
+
+    HTTPreactor(size_t workers);
+    ~HTTPreactor();
+    static HTTPreactor& instance(void);
+    static bool setNonBlocking(int sock);
+    void add(int sock, eventHandler handler);
+    void arm(int sock, int events, int timeout = -1);
+    void notify(int sock);
+    void remove(int sock);
+};
@@ -0,0 +1,206 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#define closesocket(s) close(s)
+#else
+#include <ws2tcpip.h>
+#endif
+
+#include "Logger.h"
+
+#include "HTTPserver.h"
+#include "HTTPstreamer.h"
+
+/****************************************************************************************
+ * Creation / deletion
+ */
+
+HTTPserver::HTTPserver(struct in_addr addr) : reactor(HTTPreactor::instance()) {
+    struct sockaddr_in host = { };
+    host.sin_addr = addr;
+    host.sin_family = AF_INET;
+
+    listenSock = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSock < 0) throw std::runtime_error("can't create HTTP socket " + std::string(strerror(errno)));
+
+    int on = 1;
+    setsockopt(listenSock, SOL_SOCKET, SO_REUSEADDR, (char*) &on, sizeof(on));
+
+    // only one port is needed, so take the first free one in the range (or any if no base)
+    for (int count = 0;; count++) {
+        host.sin_port = htons(portBase ? portBase + count : 0);
+        if (!bind(listenSock, (const sockaddr*) &host, sizeof(host))) break;
+        if (!portBase || count + 1 >= portRange) {
+            closesocket(listenSock);
+            throw std::runtime_error("can't bind on port " + std::string(strerror(errno)));
+        }
+    }
+
+    socklen_t len = sizeof(host);
+    getsockname(listenSock, (struct sockaddr*) &host, &len);
+    port = ntohs(host.sin_port);
+
+    if (::listen(listenSock, 16) < 0) {
+        closesocket(listenSock);
+        throw std::runtime_error("listen failed on port " + std::to_string(port) + ": " +
+                                 std::string(strerror(errno)));
+    }
+
+    CSPOT_LOG(info, "HTTP server bound to %s:%u", inet_ntoa(addr), port);
+
+    HTTPreactor::setNonBlocking(listenSock);
+    reactor.add(listenSock, [this](int events) { onListen(events); });
+    reactor.arm(listenSock, HTTPreactor::READ);
+}
+
+HTTPserver::~HTTPserver() {
+    reactor.remove(listenSock);
+    closesocket(listenSock);
+
+    // removing waits for a handler in progress that might need the lock, so it's done unlocked
+    std::map<int, pending> closing;
+    {
+        std::scoped_lock lock(mutex);
+        closing.swap(requests);
+    }
+    for (auto& [sock, request] : closing) {
+        reactor.remove(sock);
+        closesocket(sock);
+    }
+}
+
+std::shared_ptr<HTTPserver> HTTPserver::instance(struct in_addr addr) {
+    std::scoped_lock lock(instancesMutex);
+    auto& server = instances[addr.s_addr];
+    if (!server) server = std::make_shared<HTTPserver>(addr);
+    return server;
+}
+
+void HTTPserver::closeAll(void) {
+    std::map<uint32_t, std::shared_ptr<HTTPserver>> closing;
+    {
+        std::scoped_lock lock(instancesMutex);
+        closing.swap(instances);
+    }
+    // unregistering from reactor is done unlocked
+    closing.clear();
+}
+
+/****************************************************************************************
+ * Streamers registration
+ */
+
+void HTTPserver::add(std::string streamId, std::weak_ptr<HTTPstreamer> streamer) {
+    std::scoped_lock lock(mutex);
+    streamers[streamId] = streamer;
+}
+
+void HTTPserver::remove(std::string streamId) {
+    std::scoped_lock lock(mutex);
+    // a streamer being deleted is already expired, don't remove a newer one with same id
+    if (auto it = streamers.find(streamId); it != streamers.end() && it->second.expired()) streamers.erase(it);
+}
+
+/****************************************************************************************
+ * Connections handling
+ */
+
+void HTTPserver::onListen(int events) {
+    // accept all pending connections, they'll be dispatched once the request is received
+    for (int sock; (sock = accept(listenSock, NULL, NULL)) >= 0;) {
+        CSPOT_LOG(info, "got HTTP connection %u", sock);
+        HTTPreactor::setNonBlocking(sock);
+
+        std::scoped_lock lock(mutex);
+        requests[sock] = {};
+        reactor.add(sock, [this, sock](int events) { onRequest(sock, events); });
+        reactor.arm(sock, HTTPreactor::READ, requestTimeout);
+    }
+
+    reactor.arm(listenSock, HTTPreactor::READ);
+}
+
+void HTTPserver::reject(int sock, const char* status) {
+    // mutex must be locked
+    HTTPwriter response;
+    response.line("HTTP/1.0 %s", status).line("Server: spot-connect").line("Connection: close").line("");
+    send(sock, response.view().data(), response.view().size(), 0);
+    requests.erase(sock);
+    reactor.remove(sock);
+    closesocket(sock);
+}
+
+void HTTPserver::onRequest(int sock, int events) {
+    std::unique_lock lock(mutex);
+    // when server is being deleted, it owns the socket
+    auto it = requests.find(sock);
+    if (it == requests.end()) return;
+    auto& request = it->second;
+
+    if (events & HTTPreactor::TIMEOUT) {
+        CSPOT_LOG(info, "no HTTP request received on %u", sock);
+        reject(sock, "408 Request Timeout");
+        return;
+    }
+
+    // get the HTTP headers by chunks (there should be no body)
+    size_t size = request.data.size();
+    request.data.resize(size + 256);
+    int n = recv(sock, (char*) request.data.data() + size, 256, 0);
+
+    if (n <= 0) {
+        CSPOT_LOG(info, "HTTP close %u before request", sock);
+        requests.erase(sock);
+        reactor.remove(sock);
+        closesocket(sock);
+        return;
+    }
+
+    // only new data is scanned until headers are complete
+    request.data.resize(size + n);
+    auto status = request.parser.parse(std::string_view((char*) request.data.data(), request.data.size()));
+
+    if (status == HTTPparser::INCOMPLETE) {
+        reactor.arm(sock, HTTPreactor::READ, requestTimeout);
+        return;
+    }
+
+    // get the streamId from the request target
+    auto target = request.parser.target;
+    auto streamId = request.parser.query("id");
+
+    if (status == HTTPparser::INVALID || streamId.empty()) {
+        CSPOT_LOG(error, "Incorrect HTTP request, can't find streamId %.*s", (int) target.size(), target.data());
+        reject(sock, "400 Bad Request");
+        return;
+    }
+
+    std::shared_ptr<HTTPstreamer> streamer;
+    if (auto it = streamers.find(streamId); it != streamers.end()) streamer = it->second.lock();
+
+    if (!streamer) {
+        CSPOT_LOG(info, "Unknown streamId %.*s in url %.*s", (int) streamId.size(), streamId.data(), 
+                                                               (int) target.size(), target.data());
+        reject(sock, "404 Not Found");
+        return;
+    }
+
+    // streamer now owns the socket
+    auto data = std::move(request.data);
+    requests.erase(sock);
+    reactor.remove(sock);
+    lock.unlock();
+
+    streamer->attach(sock, data);
+}
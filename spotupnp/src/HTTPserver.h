@@ -0,0 +1,63 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <inttypes.h>
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <netinet/in.h>
+#endif
+
+#include "HTTPreactor.h"
+#include "HTTPparser.h"
+
+class HTTPstreamer;
+
+/****************************************************************************************
+ * HTTP front end shared by all streamers of a given address
+ *
+ * There is a single listening socket per address. Once the request line and headers have
+ * been received, the connection is handed over to the streamer whose streamId is in the
+ * url (?id=<streamId>), so tracks do not have to bind/listen/close a port of their own.
+ */
+class HTTPserver {
+private:
+    std::mutex mutex;
+    HTTPreactor& reactor;
+    int listenSock = -1;
+    std::map<std::string, std::weak_ptr<HTTPstreamer>, std::less<>> streamers;
+    struct pending {
+        std::vector<uint8_t> data;
+        HTTPparser parser;
+    };
+    std::map<int, pending> requests;
+    inline static std::mutex instancesMutex;
+    inline static std::map<uint32_t, std::shared_ptr<HTTPserver>> instances;
+
+    void onListen(int events);
+    void onRequest(int sock, int events);
+    void reject(int sock, const char* status);
+
+public:
+    inline static uint16_t portBase = 0, portRange = 1;
+    inline static int requestTimeout = 10 * 1000;
+    uint16_t port;
+
+    HTTPserver(struct in_addr addr);
+    ~HTTPserver();
+    static std::shared_ptr<HTTPserver> instance(struct in_addr addr);
+    // must be called before exit, servers use the reactor that static destruction may have deleted
+    static void closeAll(void);
+    void add(std::string streamId, std::weak_ptr<HTTPstreamer> streamer);
+    void remove(std::string streamId);
+};
@@ -7,14 +7,15 @@
 #include <memory>
 #include <vector>
 #include <inttypes.h>
-#include <sstream>
-#include <regex>
+#include <charconv>
 #include <algorithm>
 #include <atomic>
 #include <string>
+#include <chrono>
 #ifndef _WIN32
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #else
 #include <ws2tcpip.h>
@@ -23,20 +24,69 @@
 #include "Logger.h"
 
 #include "HTTPstreamer.h"
+#include "HTTPparser.h"
+#include "trackCache.h"
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <sys/mman.h>
 #define closesocket(s) close(s)
 #endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 /****************************************************************************************
  * Ring buffer (always rolls over)
  */
 
-ringBuffer::ringBuffer(size_t size) : cacheBuffer(size) {
-    buffer = new uint8_t[size];
-    this->write_p = this->read_p = buffer;
-    this->wrap = buffer + size;
+ringBuffer::ringBuffer(std::string owner, size_t size) : cacheBuffer(size), owner(owner) {
+    // budget is for the most we can hold, memory is only taken when data comes
+    this->size = memGovernor::instance().acquire(owner, size, std::min(size, minSize));
+    memGovernor::instance().release(owner, this->size % pagePool::pageSize);
+    this->size -= this->size % pagePool::pageSize;
+}
+
+ringBuffer::~ringBuffer(void) {
+    release(pages.size());
+    memGovernor::instance().release(owner, size);
+}
+
+void ringBuffer::release(size_t count) {
+    // oldest pages go back to the pool
+    for (; count && !pages.empty(); count--, first++) {
+        pagePool::instance().put(pages.front());
+        pages.pop_front();
+    }
+}
+
+void ringBuffer::flush(void) {
+    release(pages.size());
+    first = total = 0;
+}
+
+size_t ringBuffer::shrink(size_t wanted, size_t keep) {
+    // pages from the one holding keep, plus one so that writing does not roll over it
+    size_t kept = keep < total ? (total - 1) / pagePool::pageSize - keep / pagePool::pageSize + 2 : 0;
+    size_t size = std::max({ this->size - std::min(wanted, this->size), std::min(this->size, minSize), kept * pagePool::pageSize });
+    size -= size % pagePool::pageSize;
+    if (size >= this->size) return 0;
+
+    // keep the most recent data
+    if (pages.size() * pagePool::pageSize > size) release(pages.size() - size / pagePool::pageSize);
+    std::swap(size, this->size);
+
+    memGovernor::instance().release(owner, size - this->size);
+    CSPOT_LOG(info, "cache shrunk from %zu kB to %zu kB", size / 1024, this->size / 1024);
+    return size - this->size;
+}
+
+std::vector<uint8_t*> ringBuffer::takePages(void) {
+    if (first) return {};
+    std::vector<uint8_t*> taken(pages.begin(), pages.end());
+    pages.clear();
+    total = 0;
+    return taken;
 }
 
 ssize_t ringBuffer::scope(size_t offset) {
@@ -45,176 +95,326 @@ ssize_t ringBuffer::scope(size_t offset) {
     else return offset - total + level();
 }
 
-void ringBuffer::setOffset(size_t offset) {
-    if (offset >= total) read_p = write_p;
-    else if (offset < total - level()) read_p = (write_p + 1) == wrap ? buffer : write_p + 1;
-    else read_p = buffer + offset % size;
+size_t ringBuffer::peek(size_t offset, std::span<uint8_t> segments[2]) {
+    if (offset >= total || offset < oldest()) return 0;
+    size_t count = 0;
+
+    // data is read where it is, across at most 2 pages
+    for (; count < 2 && offset < total; count++) {
+        size_t pos = offset % pagePool::pageSize;
+        size_t len = std::min(pagePool::pageSize - pos, total - offset);
+        segments[count] = { pages[offset / pagePool::pageSize - first] + pos, len };
+        offset += len;
+    }
+
+    return count;
 }
 
-size_t ringBuffer::read(uint8_t* dst, size_t size, size_t min) {
-    size = std::min(size, pending());
-    if (size < min) return 0;
+uint8_t* ringBuffer::reserve(size_t& size) {
+    // need a new page, from the pool while we are below our size, otherwise the oldest one
+    if (total / pagePool::pageSize >= first + pages.size()) {
+        uint8_t* page = pages.size() * pagePool::pageSize < this->size ? pagePool::instance().get() : NULL;
+        if (!page && !pages.empty()) {
+            page = pages.front();
+            pages.pop_front();
+            first++;
+        } else if (!page) {
+            CSPOT_LOG(error, "can't get cache page for %s", owner.c_str());
+            size = 0;
+            return NULL;
+        }
+        pages.push_back(page);
+    }
 
-    size_t cont = std::min(size, (size_t) (wrap - read_p));
-    memcpy(dst, read_p, cont);
-    memcpy(dst + cont, buffer, size - cont);
+    size_t pos = total % pagePool::pageSize;
+    size = std::min(size, pagePool::pageSize - pos);
+    return pages.back() + pos;
+}
 
-    read_p += size;
-    if (read_p >= wrap) read_p -= this->size;
-    return size;
+void ringBuffer::write(const uint8_t* src, size_t size) {
+    while (size) {
+        size_t len = size;
+        uint8_t* dst = reserve(len);
+        if (!len) break;
+        memcpy(dst, src, len);
+        commit(len);
+        src += len;
+        size -= len;
+    }
 }
 
-uint8_t* ringBuffer::readInner(size_t& size) {
-    // caller *must* consume ALL data
-    size = std::min(size, pending());
-    size = std::min(size, (size_t)(wrap - read_p));
+/****************************************************************************************
+ * File buffer
+ */
 
-    uint8_t* p = read_p;
+size_t fileBuffer::peek(size_t offset, std::span<uint8_t> segments[2]) {
+    // re-read only when reader has moved out of what we have already
+    if (offset < peekOffset || offset >= peekOffset + peekLen) {
+        peekOffset = offset;
+        peekLen = 0;
+        if (offset >= total) return 0;
+#ifdef _WIN32
+        fseek(file, offset, SEEK_SET);
+        peekLen = fread(window.data(), 1, std::min(size, total - offset), file);
+#else
+        ssize_t bytes = pread(fileno(file), window.data(), std::min(size, total - offset), offset);
+        peekLen = bytes > 0 ? bytes : 0;
+#endif
+    }
 
-    read_p += size;
-    if (read_p >= wrap) read_p -= this->size;
-    return size ? p : NULL;
+    size_t skip = offset - peekOffset;
+    if (skip >= peekLen) return 0;
+    segments[0] = { window.data() + skip, peekLen - skip };
+    return 1;
 }
 
-void ringBuffer::write(const uint8_t* src, size_t size) {
-    size_t cont = std::min(size, (size_t)(wrap - write_p));
-    memcpy(write_p, src, cont);
-    memcpy(buffer, src + cont, size - cont);
+ssize_t fileBuffer::transmit(int sock, size_t offset, size_t size) {
+#ifdef __linux__
+    // file has no user-space buffering so what's written is visible to sendfile
+    off_t from = offset;
+    ssize_t bytes = offset < total ? sendfile(sock, fileno(file), &from, std::min(size, total - offset)) : 0;
+    if (!bytes) errno = EIO;
+    return bytes > 0 ? bytes : -1;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
 
-    write_p += size;
+void fileBuffer::write(const uint8_t* src, size_t size) {
+    // file is not truncated on flush
+#ifdef _WIN32
+    fseek(file, total, SEEK_SET);
+    fwrite(src, 1, size, file);
+#else
+    for (size_t done = 0; done < size;) {
+        ssize_t bytes = pwrite(fileno(file), src + done, size - done, total + done);
+        if (bytes <= 0) break;
+        done += bytes;
+    }
+#endif
     total += size;
+}
 
-    if (write_p >= wrap) write_p -= this->size;   
-    if (level() == this->size - 1) read_p = (write_p + 1 == wrap) ? buffer : write_p + 1;
+FILE* fileBuffer::takeFile(void) {
+    fflush(file);
+    FILE* taken = file;
+    file = NULL;
+    total = peekLen = 0;
+    return taken;
 }
 
+#ifndef _WIN32
 /****************************************************************************************
- * File buffer
+ * Mapped file buffer
  */
 
-size_t fileBuffer::read(uint8_t* dst, size_t size, size_t min) {
-    size = std::min(size, total);
-    if (size < min) return 0;
-   
-    fseek(file, readOffset, SEEK_SET);
-    size_t bytes = fread(dst, 1, size, file);
-    readOffset += bytes;
+mapBuffer::mapBuffer(size_t size) : cacheBuffer(size) {
+    file = tmpfile();
+    if (!file) throw std::runtime_error("can't create cache file " + std::string(strerror(errno)));
+}
+
+mapBuffer::~mapBuffer(void) {
+    for (auto segment : segments) munmap(segment, size);
+    if (file) fclose(file);
+}
+
+FILE* mapBuffer::takeFile(void) {
+    // data written in mapped segments is in the file, which has grown by whole segments
+    for (auto segment : segments) munmap(segment, size);
+    segments.clear();
+    (void)!ftruncate(fileno(file), total);
+    FILE* taken = file;
+    file = NULL;
+    total = 0;
+    return taken;
+}
+
+bool mapBuffer::grow(void) {
+    off_t length = (segments.size() + 1) * size;
+    if (ftruncate(fileno(file), length) < 0) return false;
+
+    void* segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(file), length - size);
+    if (segment == MAP_FAILED) return false;
 
-    return bytes;
+    segments.push_back((uint8_t*) segment);
+    return true;
 }
 
-uint8_t* fileBuffer::readInner(size_t& size) {
-    if (size > this->size) {
-        delete[] buffer;
-        buffer = new uint8_t[size];
-        this->size = size;
+uint8_t* mapBuffer::reserve(size_t& size) {
+    // file is not truncated on flush, so existing segments are re-used
+    if (total / this->size >= segments.size() && !grow()) {
+        CSPOT_LOG(error, "can't grow cache file to %zu bytes %s", total + this->size, strerror(errno));
+        size = 0;
+        return NULL;
     }
 
-    // caller *must* consume ALL data
-    size = std::min(size, total);
+    size_t pos = total % this->size;
+    size = std::min(size, this->size - pos);
+    return segments[total / this->size] + pos;
+}
+
+void mapBuffer::write(const uint8_t* src, size_t size) {
+    while (size) {
+        size_t len = size;
+        uint8_t* dst = reserve(len);
+        if (!len) break;
+        memcpy(dst, src, len);
+        commit(len);
+        src += len;
+        size -= len;
+    }
+}
 
-    fseek(file, readOffset, SEEK_SET);
-    size = fread(buffer, 1, size, file);
-    readOffset += size;
+size_t mapBuffer::peek(size_t offset, std::span<uint8_t> segments[2]) {
+    size_t count = 0;
 
-    return size ? buffer : NULL;
+    // data is directly accessed where it is mapped, across at most 2 segments
+    for (; count < 2 && offset < total; count++) {
+        size_t pos = offset % size;
+        size_t len = std::min(size - pos, total - offset);
+        segments[count] = { this->segments[offset / size] + pos, len };
+        offset += len;
+    }
+
+    return count;
 }
 
-void fileBuffer::write(const uint8_t* src, size_t size) {
-    fseek(file, 0, SEEK_END);
-    fwrite(src, 1, size, file);
-    total += size;
+ssize_t mapBuffer::transmit(int sock, size_t offset, size_t size) {
+#ifdef __linux__
+    // mapping is shared so what's written is visible to sendfile
+    off_t from = offset;
+    ssize_t bytes = offset < total ? sendfile(sock, fileno(file), &from, std::min(size, total - offset)) : 0;
+    if (!bytes) errno = EIO;
+    return bytes > 0 ? bytes : -1;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
 }
+#endif
 
 /****************************************************************************************
  * Class to stream audio content with HTTP
  */
 
 HTTPstreamer::HTTPstreamer(struct in_addr addr, std::string id, unsigned index, std::string codec, 
-                           bool flow, int64_t contentLength, int cacheMode, 
+                           bool flow, int64_t contentLength, int cacheMode, std::string pacing,
                            cspot::TrackInfo trackInfo, std::string_view trackUnique, int32_t startOffset,
                            onHeadersHandler onHeaders, EoSCallback onEoS) :
-                           trackUnique(trackUnique), flow(flow), trackInfo(trackInfo), cacheMode(cacheMode), 
-                           bell::Task("HTTP streamer", 32 * 1024, 0, 0) {
+                           reactor(HTTPreactor::instance()), trackUnique(trackUnique), flow(flow), 
+                           trackInfo(trackInfo), cacheMode(cacheMode), codec(codec) {
     this->streamId = id + "_" + std::to_string(index);
-    this->listenSock = socket(AF_INET, SOCK_STREAM, 0);
-    this->host = std::string(inet_ntoa(addr));
     this->onHeaders = onHeaders;
     this->onEoS = onEoS;
-    this->icy.interval = 0;
     // for flow mode, start with a negative offset so that we can always substract
     this->offset = startOffset;
+#ifdef _WIN32
     if (cacheMode == HTTP_CACHE_DISK && !flow) this->cache = std::make_unique<fileBuffer>();
-    else this->cache = std::make_unique<ringBuffer>();
+#else
+    if (cacheMode == HTTP_CACHE_DISK && !flow) this->cache = std::make_unique<mapBuffer>();
+#endif
+    else this->cache = std::make_unique<ringBuffer>(id);
 
     codecSettings settings;
+    settings.owner = id;
 
-    if (codec.find("pcm") != std::string::npos) {
-        encoder = createCodec(codecSettings::PCM, settings);
-    } else if (codec.find("wav") != std::string::npos) {
-        encoder = createCodec(codecSettings::WAV, settings);
-    } else if (codec.find("flac") != std::string::npos || codec.find("flc") != std::string::npos) {
-        (void)!sscanf(codec.c_str(), "%*[^:]:%d", &settings.flac.level);
-        encoder = createCodec(codecSettings::FLAC, settings);
-    } else if (codec.find("opus") != std::string::npos) {
-        (void)!sscanf(codec.c_str(), "%*[^:]:%d", &settings.opus.bitrate);
-        encoder = createCodec(codecSettings::OPUS, settings);
-    } else if (codec.find("vorbis") != std::string::npos) {
-        (void)!sscanf(codec.c_str(), "%*[^:]:%d", &settings.vorbis.bitrate);
-        encoder = createCodec(codecSettings::VORBIS, settings);
-    } else if (codec.find("aac") != std::string::npos) {
-        (void)!sscanf(codec.c_str(), "%*[^:]:%d", &settings.aac.bitrate);
-        encoder = createCodec(codecSettings::AAC, settings);
-    } else if (codec.find("mp3") != std::string::npos) {
-        (void) !sscanf(codec.c_str(), "%*[^:]:%d", &settings.mp3.bitrate);
-        encoder = createCodec(codecSettings::MP3, settings);
-    } else throw std::runtime_error("unknown codec");
+    encoder = createCodec(codec, settings);
 
     // now estimate the content-length
     setContentLength(contentLength);
 
-    scratchLen = flow ? encoder->icyInterval : 16384;
-    scratch = new uint8_t[scratchLen];
-  
-    struct sockaddr_in host;
-    host.sin_addr = addr;
-    host.sin_family = AF_INET;
-
-    for (int count = 0, offset = rand();; count++, offset++) {
-        host.sin_port = htons(portBase + (offset % portRange));
-        if (!bind(listenSock, (const sockaddr*) &host, sizeof(host))) break;
-        if (!portBase || count == portRange) throw std::runtime_error("can't bind on port" + std::string(strerror(errno)));
+    // pacing is <prefill>[:<catchup>], empty means as fast as possible
+    if (!pacing.empty()) {
+        this->pacing.enabled = true;
+        (void) !sscanf(pacing.c_str(), "%u:%u", &this->pacing.prefill, &this->pacing.catchup);
     }
 
-    socklen_t len = sizeof(host);
-    getsockname(listenSock, (struct sockaddr*) &host, &len);
-    this->port = ntohs(host.sin_port);
-    CSPOT_LOG(info, "Bound to port %u", this->port);
-
-    this->streamUrl = "http://" + this->host + ":" + std::to_string(this->port) + HTTP_BASE_URL + "." + this->encoder->id() + "?id=" + this->streamId;
+    chunkLen = flow ? encoder->icyInterval : 16384;
 
-    if (::listen(listenSock, 1) < 0) {
-        throw std::runtime_error("listen failed on port " +
-            std::to_string(this->port) + ": " +
-            std::string(strerror(errno)));
+    // same track with same codec might have been fully encoded before, then we just serve it but
+    // it's fetched by the encoder pool as we are called from audio thread
+    if (!flow && !startOffset && trackCache::enabled()) {
+        cacheKey = trackCache::key(trackInfo.trackId, codec);
+        storable = preloading = true;
+        preloadLength = this->contentLength > 0 || contentLength == HTTP_CL_KNOWN || exact;
     }
+
+    // all streamers of that address share the same port, request is routed using streamId
+    server = HTTPserver::instance(addr);
+    this->streamUrl = "http://" + std::string(inet_ntoa(addr)) + ":" + std::to_string(server->port) + HTTP_BASE_URL + "." + this->encoder->id() + "?id=" + this->streamId;
 }
 
 HTTPstreamer::~HTTPstreamer() {
+    server->remove(streamId);
     isRunning = false;
-    std::scoped_lock lock(runningMutex);
-    if (listenSock > 0) closesocket(listenSock);
-    delete[] scratch;
+
+    // once a handler in progress has finished, others will see that we are not running
+    streamMutex.lock();
+    streamMutex.unlock();
+
+    for (auto& [sock, client] : clients) {
+        reactor.remove(sock);
+        closesocket(sock);
+    }
+
+    // nobody uses the cache anymore, so it's time to keep what's re-usable, it's handed over, not copied
+    if (size_t total = cache->total; complete) {
+        if (auto pages = cache->takePages(); !pages.empty()) trackCache::instance().store(cacheKey, std::move(pages), total);
+        else if (FILE* file = cache->takeFile(); file) trackCache::instance().store(cacheKey, file, total);
+    }
     CSPOT_LOG(info, "HTTP streamer %s deleted", streamId.c_str());
 }
 
+void HTTPstreamer::start(void) {
+    isRunning = true;
+    server->add(streamId, weak_from_this());
+    memGovernor::instance().enlist(weak_from_this());
+    encoderPool::instance().enlist(weak_from_this());
+    memGovernor::instance().report();
+}
+
+size_t HTTPstreamer::reclaim(size_t wanted) {
+    std::unique_lock lock(streamMutex, std::try_to_lock);
+    if (!lock || !isRunning) return 0;
+
+    // a streamer that nobody listens to can give all back when it is done or stopped
+    if (clients.empty()) return state == DRAINED || state == OFF ? cache->shrink(wanted) : 0;
+
+    // otherwise only what all clients have sent, from the first cached data they have queued
+    size_t keep = cache->total;
+    for (auto& [sock, client] : clients) {
+        // one that has not been responded yet might want anything
+        if (!client->serving) return 0;
+        auto it = std::find_if(client->out.begin(), client->out.end(), [](auto& out) { return out.cached; });
+        keep = std::min(keep, it != client->out.end() ? it->from : client->cursor);
+    }
+
+    return cache->shrink(wanted, keep);
+}
+
 void HTTPstreamer::setContentLength(int64_t contentLength) {
+    std::scoped_lock lock(encodeMutex);
     // a real content-length (< 0 means estimated) might be provided by codec (offset is negative)
     uint64_t duration = trackInfo.duration - (-offset);
     int64_t length = encoder->initialize(duration);
 
     if (!length) throw std::runtime_error("can't initialize codec");
 
+    // exact length needs the whole track on disk cache and not too long to wait for, otherwise it's estimated
+    exact = contentLength == HTTP_CL_EXACT && cacheMode == HTTP_CACHE_DISK && !flow && duration && abs(length) * 1.20 < cache->capacity();
+    if (exact && exactMax && duration > exactMax * 1000ULL) {
+        CSPOT_LOG(info, "track is %u s, longer than %u s for exact content-length, using estimated one", (uint32_t) (duration / 1000), exactMax);
+        exact = false;
+    }
+
+    if (exact) {
+        this->contentLength = HTTP_CL_EXACT;
+        return;
+    } else if (contentLength == HTTP_CL_EXACT) {
+        contentLength = flow ? HTTP_CL_NONE : HTTP_CL_REAL;
+    }
+
     // add 20% headroom when it is estimated base on known duration
     if (contentLength == HTTP_CL_REAL) this->contentLength = length < 0 && duration ? abs(length) * 1.20 : abs(length);
     else if (contentLength == HTTP_CL_KNOWN) this->contentLength = length > 0 ? length : HTTP_CL_NONE;
@@ -233,104 +433,90 @@ void HTTPstreamer::getMetadata(metadata_t* metadata) {
 }
 
 void HTTPstreamer::flush() {
-    totalOut = 0;
+    std::scoped_lock lock(streamMutex, encodeMutex);
+    totalIn = totalOut = 0;
     state = OFF;
+    // content will change, nothing from track cache anymore
+    preloaded = preloading = storable = complete = encoded = false;
+    // length of what was encoded is gone, new clients wait for the new one
+    if (exact) contentLength = HTTP_CL_EXACT;
+    timeIndex.assign(1, { 0, 0 });
+    syncIndex.assign(1, 0);
+    // queued data might refer to cache, connections will be closed anyway
+    for (auto& [sock, client] : clients) {
+        client->out.clear();
+        client->outPos = client->cursor = 0;
+        client->icy.trackId.clear();
+    }
     cache->flush();
     encoder->flush();
-    icy.trackId.clear();
 }
 
-bool HTTPstreamer::connect(int sock) {
-    auto data = std::vector<uint8_t>();
+static int64_t parseNPT(std::string_view value) {
+    // start of "npt=<seconds>[.<fraction>]-..." or "npt=<h>:<mm>:<ss>[.<fraction>]-...", in ms
+    char buffer[32] = { 0 };
+    unsigned h, m;
+    double seconds;
 
-    // get the HTTP headers by chunks (there should be no body)
-    while (1) {
-        uint8_t buffer[256];
-        int n = recv(sock, (char*) buffer, sizeof(buffer), 0);
+    if (!HTTPparser::equals(value.substr(0, 4), "npt=")) return -1;
+    value = value.substr(4, value.find('-') - 4);
+    memcpy(buffer, value.data(), std::min(value.size(), sizeof(buffer) - 1));
 
-        if (n <= 0)  return false;
+    if (sscanf(buffer, "%u:%u:%lf", &h, &m, &seconds) == 3) seconds += h * 3600 + m * 60;
+    else if (sscanf(buffer, "%lf", &seconds) != 1) return -1;
 
-        data.insert(data.end(), buffer, buffer + n);
-        if (data.size() >= 4 && !memcmp(data.data() + data.size() - 4, "\r\n\r\n", 4)) break;
-    }
-
-    // regex to remove leading and trailing spaces
-    std::regex expr("^\\s+|\\s+$");
-    size_t offset = 0;
+    return seconds >= 0 ? seconds * 1000 : -1;
+}
 
-    auto nextLine = [&data, &offset](void) {
-        uint8_t* start, * end;
-        std::string line;
-        end = start = data.data() + offset;
+bool HTTPstreamer::connect(client& client) {
+    auto data = std::string_view((char*) client.request.data(), client.request.size());
+    CSPOT_LOG(info, "HTTP received =>\n%.*s", (int) data.size(), data.data());
 
-        // find eol
-        for (end = start = data.data() + offset;
-             offset < data.size() && *end != '\r' && *end != '\n';
-             end++, offset++);
+    // request has already been routed to us using the streamId and is complete
+    HTTPparser request;
+    request.parse(data);
+    HTTPwriter response;
 
-        if (offset < data.size()) {
-            line = std::string(start, end);
-            for (; (*end == '\r' || *end == '\n') && offset < data.size(); end++, offset++);
+    // get optional headers from whoever wants to have a say
+    if (onHeaders) {
+        HTTPheaders headers;
+        for (auto& field : request) {
+            std::string name(field.name), value(field.value);
+            for (auto& c : name) c = tolower(c);
+            for (auto& c : value) c = tolower(c);
+            headers[name] = value;
         }
-
-        return line;
-    };
-
-    auto dump = std::string((char*)data.data(), data.size());
-    CSPOT_LOG(info, "HTTP received =>\n%s", dump.c_str());
-
-    // get the streamId 
-    auto request = nextLine();
-
-    if (request.find("?id=") == std::string::npos) {
-        CSPOT_LOG(error, "Incorrect HTTP request, can't find streamId %s", request.c_str());
-        return false;
-    }
-
-    // check this is what's expected
-    if (request.find(streamId) == std::string::npos) {
-        CSPOT_LOG(info, "Wrong client/request %s not in  url %s", streamId.c_str(), request.c_str());
-        return false;
+        for (auto& [name, value] : onHeaders(headers)) response.line("%s: %s", name.c_str(), value.c_str());
     }
 
-    HTTPheaders response, headers;
-
-    // parse headers
-    for (auto line = nextLine(); !line.empty(); line = nextLine()) {
-        size_t pos = line.find(':');
-        if (pos == std::string::npos) continue;
-        for (auto it = line.begin(); it != line.end(); ++it) *it = tolower(*it);
-        headers[std::regex_replace(line.substr(0, pos), expr, "")] = std::regex_replace(line.substr(pos + 1), expr, "");
-    }
-
-    // get optional headers from whoever wants to have a say
-    if (onHeaders) response = onHeaders(headers);
-
-    std::string status = "200 OK";
-    chunked = request.find("HTTP/1.1") != std::string::npos && contentLength == HTTP_CL_CHUNKED;
+    const char* status = "200 OK";
+    bool& chunked = client.chunked;
+    chunked = request.version == "HTTP/1.1" && contentLength == HTTP_CL_CHUNKED;
 
-    bool sendBody = request.find("HEAD") == std::string::npos;
-    bool isSonos = headers["user-agent"].find("sonos") != std::string::npos;
+    bool sendBody = request.method != "HEAD";
+    bool isSonos = HTTPparser::contains(request.header("user-agent"), "sonos");
     // if we know the real length because it's a redo, then tell it if authorized
-    int64_t length = (state == DRAINED && (contentLength >= 0 || contentLength == HTTP_CL_KNOWN)) ? totalOut : contentLength;
+    int64_t length = (state == DRAINED && (contentLength >= 0 || contentLength == HTTP_CL_KNOWN)) ? (int64_t) totalOut : contentLength;
     
     // check if icy metadata is requested
-    if (auto it = headers.find("icy-metadata"); it != headers.end() && flow) {
-       icy.remain = icy.interval = std::max(scratchLen, encoder->icyInterval);
-       response["icy-metaint"] = std::to_string(icy.interval);
+    if (request.has("icy-metadata") && flow) {
+       client.icy.remain = client.icy.interval = std::max(chunkLen, encoder->icyInterval);
+       response.line("icy-metaint: %zu", client.icy.interval);
     }
 
     // check various DLNA fields
-    if (auto it = headers.find("transferMode.dlna.org"); it != headers.end()) response["transferMode.dlna.org"] = it->second;
-    if (auto it = headers.find("getcontentFeatures.dlna.org"); it != headers.end()) {
-        char* DLNA_ORG = makeDLNA_ORG(encoder->id().c_str(), cacheMode != HTTP_CACHE_MEM, flow);
-        response["contentFeatures.dlna.org"] = DLNA_ORG;
+    if (request.has("transferMode.dlna.org")) {
+        auto value = request.header("transferMode.dlna.org");
+        response.line("transferMode.dlna.org: %.*s", (int) value.size(), value.data());
+    }
+    if (request.has("getcontentFeatures.dlna.org")) {
+        char* DLNA_ORG = makeDLNA_ORG(encoder->id().c_str(), cacheMode != HTTP_CACHE_MEM, flow, pacing.enabled);
+        response.line("contentFeatures.dlna.org: %s", DLNA_ORG);
         free(DLNA_ORG);
     }
-    if (auto it = headers.find("getAvailableSeekRange.dlna.org"); it != headers.end() && cache->total) {
-        response["contentFeatures.dlna.org"] = "availableSeekRange.dlna.org: 0 bytes=" +
-                                               std::to_string(cache->total - (cacheMode == HTTP_CACHE_MEM ? cache->level() : 0)) +
-                                               "-" + std::to_string(cache->total - 1);
+    if (request.has("getAvailableSeekRange.dlna.org") && cache->total) {
+        response.line("availableSeekRange.dlna.org: 0 bytes=%zu-%zu",
+                      cache->total - (cacheMode == HTTP_CACHE_MEM ? cache->level() : 0), cache->total - 1);
     }
 
     /* There is a fair bit of HTTP soup below and the problem is many Sonos speakers. When paused
@@ -342,46 +528,63 @@ bool HTTPstreamer::connect(int sock) {
      * for a proper range request but we need to answer 206 without a content-range (which is not 
      * compliant) or they fail as well */
 
-    // by default, use cache and restart from oldest (might change that below)
-    useCache = true;
-    cache->setOffset(0);
-
-    // handle range-request 
-    if (auto it = headers.find("range"); it != headers.end() && cache->total) {
+    // by default, use cache and restart from oldest (might change that below) where a decoder can start
+    client.cursor = snap(cache->oldest());
+
+    // handle DLNA time-based seek, the response is 200 with the actual time range
+    if (auto seek = request.header("TimeSeekRange.dlna.org"); request.has("TimeSeekRange.dlna.org") && !flow && cache->total) {
+        int64_t start = parseNPT(seek);
+        uint32_t ms = std::max(start, (int64_t) 0);
+        ssize_t position = start >= 0 ? seekTime(ms) : -1;
+
+        if (position >= 0) {
+            double duration = (trackInfo.duration + this->offset) / 1000.0;
+            // actual start might differ from what was asked, when not encoded or not cached anymore
+            response.line("TimeSeekRange.dlna.org: npt=%.3f-%.3f/%.3f", ms / 1000.0, duration, duration);
+            client.cursor = snap(position);
+            CSPOT_LOG(info, "time seek at %.3fs served from %.3fs at %zu (cached:%zu)", start / 1000.0, ms / 1000.0, client.cursor, cache->total);
+            length = 0;
+        } else {
+            sendBody = false;
+            status = "416 Range Not Satisfiable";
+            response.clear();
+            CSPOT_LOG(info, "can't serve time seek %.*s (cached:%zu)", (int) seek.size(), seek.data(), cache->total);
+        }
+    } else if (auto range = request.header("range"); range.data() && cache->total) {
         size_t offset = 0;
-        (void) !sscanf(it->second.c_str(), "bytes=%zu", &offset);
+        if (HTTPparser::equals(range.substr(0, 6), "bytes=")) std::from_chars(range.data() + 6, range.data() + range.size(), offset);
 
         // this is not an initial request (there is cache), so if offset is 0, we are all set
         if (offset) {
             if (state != DRAINED && cache->total == offset) {
                 // special case where we just continue so we'll do a 200 with no cache
-                useCache = false;
+                client.cursor = cache->total;
             } else if (cache->scope(offset) == 0) {
                 // first try to see if we can serve that
                 status = "206 Partial Content";
                 // see note above
-                if (!isSonos) response["Content-Range"] = "bytes " + std::to_string(offset) + 
-                                                          "-" + std::to_string(cache->total - 1) + "/*";
+                if (!isSonos) response.line("Content-Range: bytes %zu-%zu/*", offset, cache->total - 1);
                 // do not sent content-length on PartialResponse
-                cache->setOffset(offset);
+                client.cursor = offset;
                 CSPOT_LOG(info, "service partial-content %zu-%zu (length:%" PRId64 ")", offset, cache->total - 1, length);
                 length = 0;
-            } else if (state == DRAINED && offset >= cache->total) {
+            } else if ((state == DRAINED || exact) && offset >= cache->total) {
                 // there is an offset out of scope and we are drained, we are tapping in estimated length
                 sendBody = false;
                 status = "416 Range Not Satisfiable";
                 response.clear();
-                response["Content-Range"] = "bytes */" + std::to_string(cache->total);
+                response.line("Content-Range: bytes */%zu", cache->total);
                 CSPOT_LOG(info, "can't serve offset %zu (cached:%zu)", offset, cache->total);
             } else {
                 // this likely means we are being probed toward the end of the file (which we don't have)
                 status = "206 Partial Content";
                 size_t avail = std::min(cache->total, (size_t) (length - offset));
-                cache->setOffset(cache->total - avail);
-                response["Content-Range"] = "bytes " + std::to_string(offset) +
-                    "-" + std::to_string(offset + avail - 1) + "/" + std::to_string(length);
+                // we choose where we start so it can be where decoder can
+                client.cursor = snap(cache->total - avail);
+                avail = cache->total - client.cursor;
+                response.line("Content-Range: bytes %zu-%zu/%" PRId64, offset, offset + avail - 1, length);
                 CSPOT_LOG(info, "being probed at %zu but have %zu/%" PRId64 ", using offset at %zu", offset,
-                                 cache->total, length, cache->total - avail);
+                                 cache->total, length, client.cursor);
                 length = 0;
             }
         } else if (state == DRAINED) {
@@ -395,89 +598,290 @@ bool HTTPstreamer::connect(int sock) {
         status = "410 Gone";
         response.clear();
         CSPOT_LOG(info, "won't resend from start when already fully served");
-    } else if (cache->total) {
+    } else if (cache->total && (requested || !preloaded)) {
         // restart from the beginning if we have cache (see note above regarding Sonos)
-        if (isSonos) length = INT64_MAX;
-        CSPOT_LOG(info, "service with cache from %zu (cached:%zu)", cache->total - cache->level(), cache->total);
+        if (isSonos && !exact) length = INT64_MAX;
+        CSPOT_LOG(info, "service with cache from %zu (cached:%zu)", client.cursor, cache->total);
     } else {
-        // initial request, don't use cache (there is non anyway)
-        useCache = false;
+        // initial request, don't use cache (there is none anyway) unless it was pre-loaded
+        if (!preloaded) client.cursor = cache->total;
     }
 
-    // c++ conversion to string is really a joke
-    std::stringstream responseStr;
-    responseStr << (chunked ? "HTTP/1.1 " : "HTTP/1.0 ") + status + "\r\n";
+    // status line and length come first, then accumulated headers
+    HTTPwriter header;
+    header.line("%s %s", chunked ? "HTTP/1.1" : "HTTP/1.0", status);
     
     if (sendBody) {
         if (length > 0) {
             chunked = false;
-            responseStr << "Content-Length: " + std::to_string(length) + "\r\n";
+            header.line("Content-Length: %" PRId64, length);
         } else if (chunked) {
-            responseStr << "Transfer-Encoding: chunked\r\n";
+            header.line("Transfer-Encoding: chunked");
         }
     }
 
-    // send accumulated headers
-    for (auto it = response.cbegin(); it != response.cend(); ++it) responseStr << it->first + ": " + it->second + "\r\n";
-    responseStr << "Server: spot-connect\r\n";
-    responseStr << "Accept-Ranges: bytes\r\n";
-    responseStr << "Content-Type: " + encoder->mimeType + "\r\n";
-    responseStr << "Connection: close\r\n";
-    responseStr << "\r\n";
+    header.append(response.view());
+    header.line("Server: spot-connect");
+    header.line("Accept-Ranges: bytes");
+    header.line("Content-Type: %s", encoder->mimeType.c_str());
+    header.line("Connection: close");
+    header.line("");
     
-    send(sock, responseStr.str().c_str(), responseStr.str().size(), 0);
-    CSPOT_LOG(info, "HTTP response =>\n%s", responseStr.str().c_str());
+    queue(client, header.view());
+    requested = true;
+    CSPOT_LOG(info, "HTTP response =>\n%.*s", (int) header.view().size(), header.view().data());
 
     return sendBody;
 }
 
-ssize_t HTTPstreamer::sendChunk(int sock, uint8_t* data, ssize_t size, bool count) {
-    if (chunked) {
+void HTTPstreamer::queue(client& client, std::string_view bytes) {
+    // aggregate with previous bytes as much as possible
+    if (client.out.empty() || client.out.back().cached) client.out.push_back({ std::string(bytes) });
+    else client.out.back().bytes += bytes;
+}
+
+void HTTPstreamer::queueChunk(client& client, std::string_view bytes, size_t from, size_t cached) {
+    // data is queued and will be sent as the socket accepts it
+    size_t size = cached ? cached : bytes.size();
+
+    if (client.chunked) {
         char chunk[16];
-        sprintf(chunk, "%zx\r\n", size);
-        if (send(sock, chunk, strlen(chunk), 0) < 0) return 0;
+        snprintf(chunk, sizeof(chunk), "%zx\r\n", size);
+        queue(client, chunk);
     }
 
-    ssize_t bytes = size;
+    // cached data is not copied, it will be taken from cache when sending
+    if (cached) client.out.push_back({ "", from, cached });
+    else queue(client, bytes);
+    if (client.chunked) queue(client, "\r\n");
+}
+
+int HTTPstreamer::flushOut(client& client) {
+    // return 1 when all is sent, 0 when socket is full and -1 on error
+    while (!client.out.empty()) {
+        auto& front = client.out.front();
+        ssize_t sent;
+
+        if (front.cached && front.from < cache->oldest()) {
+            // ring buffer has rolled over data we have not sent yet
+            CSPOT_LOG(error, "HTTP client %d of %s is too late at %zu (oldest:%zu)", client.sock, streamId.c_str(), front.from, cache->oldest());
+            return -1;
+        } else if (front.cached && cache->zeroCopy()) {
+            // disk cache is sent by the kernel straight from file (replay and live data alike)
+            sent = cache->transmit(client.sock, front.from, front.cached);
+            if (sent > 0) {
+                front.from += sent;
+                if (!(front.cached -= sent)) client.out.pop_front();
+                continue;
+            }
+        } else {
+            sent = gatherOut(client);
+        }
 
-    while (bytes) {
-        ssize_t sent = send(sock, (char*) data + size - bytes, bytes, 0);
-        // might be chunked mode, but no reason to send and end-of-chunk
-        if (sent < 0) return size - bytes;
-        bytes -= sent;
+        if (sent < 0) {
+#ifdef _WIN32
+            int error = WSAGetLastError();
+            if (error == WSAEWOULDBLOCK) return 0;
+#else
+            int error = errno;
+            if (error == EAGAIN || error == EWOULDBLOCK || error == EINTR) return 0;
+#endif
+            CSPOT_LOG(error, "HTTP error %d for %s => send %zu (%d)", error, streamId.c_str(), (size_t) totalOut, client.sock);
+            return -1;
+        }
+
+        // move forward in what has been sent
+        for (size_t bytes = sent; bytes && !client.out.empty();) {
+            auto& front = client.out.front();
+            if (front.cached) {
+                size_t len = std::min(bytes, front.cached);
+                front.from += len;
+                front.cached -= len;
+                bytes -= len;
+                if (!front.cached) client.out.pop_front();
+            } else {
+                size_t len = std::min(bytes, front.bytes.size() - client.outPos);
+                client.outPos += len;
+                bytes -= len;
+                if (client.outPos == front.bytes.size()) {
+                    client.out.pop_front();
+                    client.outPos = 0;
+                }
+            }
+        }
     }
 
-    if (chunked) {
-        send(sock, "\r\n", 2, 0);
+    return 1;
+}
+
+ssize_t HTTPstreamer::gatherOut(client& client) {
+    int flags = 0;
+#ifdef _WIN32
+    WSABUF iov[16];
+    auto set = [&iov](int n, uint8_t* data, size_t len) { iov[n].buf = (char*) data; iov[n].len = len; };
+#else
+    struct iovec iov[16];
+    auto set = [&iov](int n, uint8_t* data, size_t len) { iov[n].iov_base = data; iov[n].iov_len = len; };
+#endif
+    int n = 0;
+
+    // gather queued bytes and cache segments in a single call
+    for (auto it = client.out.begin(); it != client.out.end() && n < 16; ++it) {
+        if (!it->cached) {
+            size_t pos = it == client.out.begin() ? client.outPos : 0;
+            set(n++, (uint8_t*) it->bytes.data() + pos, it->bytes.size() - pos);
+            continue;
+        }
+
+        std::span<uint8_t> segments[2];
+        size_t count = cache->zeroCopy() ? 0 : cache->peek(it->from, segments), len = it->cached;
+
+        for (size_t i = 0; len && i < count && n < 16; i++, n++) {
+            size_t chunk = std::min(len, segments[i].size());
+            set(n, segments[i].data(), chunk);
+            len -= chunk;
+        }
+
+        // what's after must wait until all these cached data are sent
+        if (len) {
+#ifdef MSG_MORE
+            // cached data will follow using sendfile
+            if (cache->zeroCopy()) flags = MSG_MORE;
+#endif
+            break;
+        }
     }
 
-    if (count) totalOut += size;
+#ifdef _WIN32
+    DWORD sent = 0;
+    if (!n) WSASetLastError(WSAENOBUFS);
+    return n && WSASend(client.sock, iov, n, &sent, flags, NULL, NULL) != SOCKET_ERROR ? (ssize_t) sent : -1;
+#else
+    struct msghdr msg = { };
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n;
+    if (!n) errno = ENOBUFS;
+    return n ? sendmsg(client.sock, &msg, flags) : -1;
+#endif
+}
+
+size_t HTTPstreamer::produce(void) {
+    // when pre-loaded from track cache, there is nothing more to come (and nothing until we know)
+    if (preloaded || preloading) return 0;
+
+    // get fresh data from encoder straight into cache
+    size_t size = chunkLen;
+    uint8_t* data = cache->reserve(size);
+    size = encoder->read(data, size);
+    cache->commit(size);
+    totalOut += size;
+
+    // there is room for encoder now (or for what is left to drain)
+    if (size && (encoder->transcodes() || state == DRAINING)) encoderPool::instance().signal();
+
+    // sync points that are in cache now, forget the ones that have rolled out
+    encoder->syncPoints(cache->total, syncIndex);
+    while (syncIndex.size() > 1 && syncIndex.front() < cache->oldest()) syncIndex.pop_front();
+
+    if (size) {
+        // PCM behind what is in cache, encoder might have more ready (ratio is close enough)
+        uint64_t produced = encoder->produced();
+        size_t consumed = encoder->compressed() ? (produced ? encoder->consumed() * totalOut / produced : 0) :
+                                                  totalIn - std::min((size_t) totalIn, encoder->pending());
+        uint32_t ms = consumed * 1000 / (44100 * 4);
+        // pacing needs the encoded rate, let it settle a bit
+        if (ms > 1000) byteRate = totalOut * 1000.0 / ms;
+        // index what has been encoded by now, except in flow where time is continuous
+        if (!flow) timeIndex.emplace_back(std::max(ms, timeIndex.back().first), cache->total);
+    }
+
+    // same for time marks, so that seeks don't land on what is not cached anymore
+    while (timeIndex.size() > 1 && timeIndex.front().second < cache->oldest()) timeIndex.pop_front();
+
     return size;
 }
 
-ssize_t HTTPstreamer::streamBody(int sock, struct timeval& timeout) {
-    ssize_t size = 0;
+size_t HTTPstreamer::snap(size_t offset) {
+    // raw formats can start at any block
+    if (size_t align = encoder->blockAlign(); align) return std::min((offset + align - 1) / align * align, cache->total);
+
+    // otherwise first sync point from offset, if we have one
+    auto it = std::lower_bound(syncIndex.begin(), syncIndex.end(), offset);
+    return it != syncIndex.end() ? *it : offset;
+}
 
-    // cache has priority
-    if (useCache) {
-        size = cache->read(scratch, scratchLen);
-        if (!size) useCache = false;
+ssize_t HTTPstreamer::seekTime(uint32_t& ms) {
+    ssize_t position;
+    int64_t duration = trackInfo.duration + offset;
+
+    if ((duration > 0 && ms > duration) || (!preloaded && ms > timeIndex.back().first && (encoded || state == DRAINED))) {
+        // beyond the end of the track
+        position = -1;
+    } else if (preloaded) {
+        // content from track cache is not indexed, assume that rate is constant
+        position = duration > 0 ? cache->total * ms / duration : -1;
+    } else if (ms > timeIndex.back().first) {
+        // not encoded yet, serve from the last point a decoder can start at and let the renderer catch up
+        position = encoder->blockAlign() ? cache->total : std::max(syncIndex.back(), (uint64_t) cache->oldest());
+        auto it = std::upper_bound(timeIndex.begin(), timeIndex.end(), (size_t) position, [](size_t offset, auto& mark) { return offset < mark.second; });
+        ms = it != timeIndex.begin() ? std::prev(it)->first : timeIndex.front().first;
+    } else if (ms < timeIndex.front().first) {
+        // has rolled out of cache, the oldest mark is the nearest we have
+        position = timeIndex.front().second;
+        ms = timeIndex.front().first;
+    } else {
+        // last mark at or before requested time
+        auto it = std::upper_bound(timeIndex.begin(), timeIndex.end(), ms, [](uint32_t ms, auto& mark) { return ms < mark.first; });
+        position = std::prev(it)->second;
     }
 
-    // not using cache or empty cache, get fresh data from encoder
-    if (!size) {
-        size = encoder->read(scratch, scratchLen, 0, state == DRAINING);
-        // cache what we have anyway
-        cache->write(scratch, size);
+    return position >= 0 && (cache->scope(position) == 0 || position == (ssize_t) cache->total) ? position : -1;
+}
+
+size_t HTTPstreamer::pace(client& client, size_t size) {
+    // content from track cache has a known rate, otherwise wait for encoder to tell
+    double rate = preloaded && trackInfo.duration ? cache->total * 1000.0 / (trackInfo.duration + offset) : byteRate;
+    if (!pacing.enabled) return size;
+
+    uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (!client.pace.start) client.pace.start = now;
+
+    // until rate is known, we are in prefill anyway
+    if (rate <= 0) {
+        client.pace.sent += size;
+        return size;
     }
 
-    // we really have nothing, let caller decide what's next
-    if (!size) {
-        timeout.tv_usec = 50 * 1000;
+    // prefill is sent at once, then real-time plus catchup
+    double speed = rate * (100 + pacing.catchup) / 100 / 1000;
+    double allowed = rate * pacing.prefill + speed * (now - client.pace.start) - client.pace.sent;
+
+    // don't send crumbs when ahead, wait for a reasonable amount
+    if (allowed < size && allowed < chunkLen / 4) {
+        client.pace.wait = std::max(1.0, (chunkLen / 4 - allowed) / speed);
         return 0;
     }
 
-    int offset = 0;
+    size = std::min(size, (size_t) allowed);
+    client.pace.sent += size;
+    client.pace.wait = 0;
+    return size;
+}
+
+ssize_t HTTPstreamer::streamBody(client& client) {
+    // client has caught up with what is cached, try to get fresh data
+    if (client.cursor >= cache->total && (state == STREAMING || state == DRAINING)) produce();
+
+    size_t size = std::min(cache->total - std::min(client.cursor, cache->total), chunkLen);
+
+    // renderer might want data at its own pace
+    if (size) size = pace(client, size);
+
+    // we really have nothing, let caller decide what's next
+    if (!size) return 0;
+
+    auto& icy = client.icy;
+    size_t offset = 0;
 
     // check if ICY sending is active (len < ICY_INTERVAL)
     if (icy.interval && size > icy.remain) {
@@ -501,113 +905,288 @@ ssize_t HTTPstreamer::streamBody(int sock, struct timeval& timeout) {
 
         // send remaining data first
         offset = icy.remain;
-        if (offset) sendChunk(sock, (uint8_t*)scratch, offset, !useCache);
+        if (offset) queueChunk(client, {}, client.cursor, offset);
         size -= offset;
 
         // then send icy data
-        sendChunk(sock, (uint8_t*) buffer, len_16 * 16 + 1, false);
+        queueChunk(client, std::string_view(buffer, len_16 * 16 + 1));
         icy.remain = icy.interval;
     }
 
-    ssize_t sent = sendChunk(sock, (uint8_t*) scratch + offset, size, !useCache);
+    queueChunk(client, {}, client.cursor + offset, size);
+    client.cursor += offset + size;
     
     // update remaining count with desired length
     if (icy.interval) icy.remain -= size;
 
-    if (sent != size) {
-#ifdef _WIN32
-        int error = WSAGetLastError();
-#else
-        int error = errno;
-#endif
-        CSPOT_LOG(error, "HTTP error %d for %s => send %zd / %zd (%d)", error, streamId.c_str(), sent, size, sock);
-        return sent - size;
-    }
-
-    timeout.tv_usec = 0;   
     return size;
 }
 
+void HTTPstreamer::wake(void) {
+    // bump sequence first so that a client about to go idle sees there is something new
+    sequence++;
+    std::scoped_lock lock(idleMutex);
+    for (auto sock : idleSocks) reactor.notify(sock);
+    idleSocks.clear();
+}
+
+void HTTPstreamer::drain(void) {
+    state = DRAINING;
+    encoderPool::instance().signal();
+    wake();
+}
+
 bool HTTPstreamer::feedPCMFrames(const uint8_t* data, size_t size) {
-    if (isRunning && encoder->pcmWrite(data, size)) {
+    // when pre-loaded from track cache, audio is not needed
+    if (isRunning && (preloaded || encoder->pcmWrite(data, size))) {
         totalIn += size;
+        // raw formats are directly available to HTTP, others need to be encoded first
+        if (preloaded) return true;
+        else if (encoder->transcodes() || exact) encoderPool::instance().signal();
+        else wake();
         return true;
     } else {
         return false;
     }
 }
 
-void HTTPstreamer::runTask() {
-    std::scoped_lock lock(runningMutex);
-    isRunning = true;
+int HTTPstreamer::urgency(void) {
+    if (!isRunning) return 0;
 
-    int sock = -1;
-    struct timeval timeout = { 0, 25 * 1000 };
+    // what is being listened to goes first, then what is buffered for later
+    int priority = listened ? 2 : 1;
 
-    while (isRunning) {
-        fd_set rfds;
-        bool success = true;
+    // track cache might have it all
+    if (preloading) return priority;
 
-        if (sock == -1) {
-            struct timeval timeout = { 0, 50 * 1000 };
+    // with exact length, even raw formats need to be moved to cache (also once encoded)
+    if (exact && encoder->backlog()) return priority;
+    if (encoded) return 0;
 
-            FD_ZERO(&rfds);
-            FD_SET(listenSock, &rfds);
+    // everything has been received, what's left is to drain encoder
+    if (!encoder->pending() || !encoder->transcodes()) return state == DRAINING ? priority : 0;
 
-            if (select(listenSock + 1, &rfds, NULL, NULL, &timeout) > 0) {
-                sock = accept(listenSock, NULL, NULL);
-            }
+    // don't go too far ahead of HTTP, using the observed PCM to encoded ratio
+    uint64_t consumed = encoder->consumed(), backlog = encoder->backlog();
+    if (encoderPool::ahead && !exact && consumed && backlog * consumed / (totalOut + backlog) > encoderPool::ahead * 44100 * 4) return 0;
+
+    return priority;
+}
+
+void HTTPstreamer::preload(void) {
+    std::scoped_lock lock(streamMutex);
+    preloading = false;
+
+    // when it's not there anymore, audio is still received and we encode as usual
+    if (!trackCache::instance().fetch(cacheKey, cache->capacity(), [this](const uint8_t* data, size_t size) {
+                                          cache->write(data, size);
+                                      })) return;
+
+    // PCM received so far is left in encoder, it's never encoded
+    preloaded = encoded = true;
+    totalOut = cache->total;
+    if (preloadLength) contentLength = cache->total;
+    wake();
+}
 
-            if (sock == -1 || !isRunning) continue;
-            CSPOT_LOG(info, "got HTTP connection %u", sock);
+bool HTTPstreamer::encode(void) {
+    std::scoped_lock lock(encodeMutex);
+
+    if (preloading && isRunning) {
+        preload();
+        return true;
+    }
+
+    if (!isRunning || (encoded && !(exact && encoder->backlog()))) return false;
+
+    uint64_t in = encoder->consumed(), out = encoder->produced();
+
+    // once draining is set, all PCM has been received
+    if (encoded) {
+        // only left to move to cache
+    } else if (state == DRAINING && (!encoder->pending() || !encoder->transcodes())) {
+        encoded = encoder->drain();
+        if (encoded) report();
+    } else {
+        encoder->encode(chunkLen * 4);
+    }
+
+    // with exact length, all goes to cache before anybody is served (can't wait for HTTP), but by
+    // slices so that other jobs get workers as well (there is still backlog, so we'll be back)
+    bool cached = false;
+    if (exact) {
+        std::scoped_lock lock(streamMutex);
+        for (int count = 0; count < 16 && produce(); count++) cached = true;
+        if (encoded && !encoder->backlog()) {
+            contentLength = cache->total;
+            CSPOT_LOG(info, "track %s fully encoded with length %zu", streamId.c_str(), cache->total);
         }
+    }
 
-        FD_ZERO(&rfds);
-        FD_SET(sock, &rfds);
+    // clients waiting for data might go now
+    bool produced = encoder->produced() != out;
+    if (produced || encoded) wake();
 
-        int n = select(sock + 1, &rfds, NULL, NULL, &timeout);
+    return produced || encoded || cached || encoder->consumed() != in;
+}
 
-        if (n > 0) {
-            success = connect(sock);
-            // we might already be in draining mode
-            if (success && state <= STREAMING) state = STREAMING;
-            else if (state == DRAINED) useCache = true;
+double HTTPstreamer::encodeSpeed(void) {
+    std::scoped_lock lock(encodeMutex);
+    return encoder->speed();
+}
+
+void HTTPstreamer::report(void) {
+    // only encoders have a cost worth reporting
+    double speed = encoder->speed();
+    if (!speed || !encoder->transcodes()) return;
+
+    double duration = encoder->consumed() / (44100.0 * 4);
+    double rate = encoder->produced() / duration;
+    CSPOT_LOG(info, "encoded %.1fs of <%s> with %s: %.1fx realtime, %.0f bytes/s, first data after %u ms", 
+              duration, trackInfo.name.c_str(), codec.c_str(), speed, rate, encoder->latency());
+
+    if (statsFile.empty()) return;
+
+    // one JSON object per line so that it can be collected and compared across versions/platforms
+    static std::mutex fileMutex;
+    std::scoped_lock lock(fileMutex);
+    FILE* file = fopen(statsFile.c_str(), "a");
+    if (!file) return;
+    fprintf(file, "{\"time\":%lld,\"codec\":\"%s\",\"track\":\"%s\",\"duration\":%.3f,\"speed\":%.2f,"
+                  "\"byteRate\":%.0f,\"latency\":%u,\"threads\":%u}\n",
+            (long long) time(NULL), codec.c_str(), trackInfo.trackId.c_str(), duration, speed, rate, 
+            encoder->latency(), (unsigned) encoderPool::workerCount);
+    fclose(file);
+}
+
+void HTTPstreamer::attach(int sock, std::vector<uint8_t>& request) {
+    std::scoped_lock lock(streamMutex);
+
+    if (!isRunning || clients.size() >= maxClients) {
+        if (isRunning) CSPOT_LOG(info, "too many HTTP clients for %s", streamId.c_str());
+        closesocket(sock);
+        return;
+    }
+
+    auto& client = clients[sock] = std::make_unique<HTTPstreamer::client>(sock, std::move(request));
+
+    // request has been fully received, so just wait to be able to respond
+    reactor.add(sock, [this, client = client.get()](int events) { onClient(*client, events); });
+    reactor.arm(sock, HTTPreactor::WRITE);
+}
+
+void HTTPstreamer::closeClient(client& client) {
+    // streamMutex must be locked and client must not be used once closed
+    int sock = client.sock;
+    reactor.remove(sock);
+    {
+        std::scoped_lock lock(idleMutex);
+        idleSocks.erase(std::remove(idleSocks.begin(), idleSocks.end(), sock), idleSocks.end());
+    }
+    closesocket(sock);
+    clients.erase(sock);
+
+    // we are not streaming when the last one has left
+    bool serving = std::any_of(clients.begin(), clients.end(), [](auto& item) { return item.second->serving; });
+    if (state == STREAMING && !serving) state = CONNECTING;
+    listened = serving;
+}
+
+void HTTPstreamer::onClient(client& client, int events) {
+    std::scoped_lock lock(streamMutex);
+    if (!isRunning) return;
+
+    int sock = client.sock;
+    uint32_t seen = sequence;
+
+    if (events & HTTPreactor::READ) {
+        uint8_t buffer[256];
+        int n = recv(sock, (char*) buffer, sizeof(buffer), 0);
+
+        // HTTP peer has left or failed
+        if (n <= 0) {
+            CSPOT_LOG(info, "HTTP close %u (sent:%zu)", sock, (size_t) totalOut);
+            closeClient(client);
+            return;
         }
 
-        // terminate connection if required by HTTP peer
-        if (n < 0 || (!success && state <= CONNECTING)) {
-            CSPOT_LOG(info, "HTTP close %u (sent:%zu)", sock, totalOut);
-            closesocket(sock);
-            sock = -1;
-            if (state == STREAMING) state = CONNECTING;
-            continue;
+        // nothing is expected once we have received the request, just ignore it
+    }
+
+    // request was received by server, now respond
+    if (!client.serving) {
+        // exact length is only known once all is encoded (again after a seek), wait for it (or for peer to go away)
+        if (exact && (contentLength == HTTP_CL_EXACT || !encoded)) {
+            listened = true;
+            std::scoped_lock lock(idleMutex);
+            if (std::find(idleSocks.begin(), idleSocks.end(), sock) == idleSocks.end()) idleSocks.push_back(sock);
+            reactor.arm(sock, HTTPreactor::READ);
+            return;
         }
 
-        // try to stream some data 
-        ssize_t sent = state >= STREAMING || (state == DRAINED && useCache) ? streamBody(sock, timeout) : 0;
-
-        if (state >= DRAINING && !sent) {
-           // chunked-encoding terminates by a last empty chunk ending sequence
-           if (chunked) send(sock, "0\r\n\r\n", 5, 0);
-
-           CSPOT_LOG(info, "closing socket %d (sent:%zu), now lingering", sock, totalOut);
-           if (state == DRAINING && onEoS) onEoS(this);
-           state = DRAINED;      
-
-           shutdown(sock, SHUT_RDWR);
-           closesocket(sock);
-           sock = -1;
-        } else if (sent < 0) {
-            // something happened in streamBody, let's close the socket and wait for next request
-            CSPOT_LOG(info, "early closing socket %d (sent:%zu)", sock, totalOut);
-            closesocket(sock);
-            sock = -1;
-        } else {
-            timeout.tv_usec = 50 * 1000;
+        bool success = connect(client);
+        client.request.clear();
+        client.serving = true;
+
+        // we might already be in draining mode
+        if (success && state <= STREAMING) state = STREAMING;
+        else if (!success) client.lingering = true;
+        listened = listened || success;
+    }
+
+    // send as much as we can, without monopolizing a worker for too long
+    for (int count = 0; count < 16; count++) {
+        int status = flushOut(client);
+
+        if (status < 0) {
+            // something happened while sending, let's close the socket and wait for next request
+            CSPOT_LOG(info, "early closing socket %d (sent:%zu)", sock, (size_t) totalOut);
+            closeClient(client);
+            return;
+        } else if (!status) {
+            reactor.arm(sock, HTTPreactor::READ | HTTPreactor::WRITE);
+            return;
+        } else if (client.lingering) {
+            CSPOT_LOG(info, "closing socket %d (sent:%zu), now lingering", sock, (size_t) totalOut);
+            shutdown(sock, SHUT_RDWR);
+            closeClient(client);
+            return;
+        }
+
+        // try to stream some data, but the end is only when all has been encoded
+        bool finished = encoded;
+        ssize_t sent = state >= STREAMING ? streamBody(client) : 0;
+
+        if (!sent && client.pace.wait) {
+            // ahead of schedule, come back when we can send again (or when peer goes away)
+            reactor.arm(sock, HTTPreactor::READ, client.pace.wait);
+            client.pace.wait = 0;
+            return;
+        } else if (state >= DRAINING && !sent && finished) {
+            // chunked-encoding terminates by a last empty chunk ending sequence
+            if (client.chunked) queue(client, "0\r\n\r\n");
+            // a full track (not interrupted by a skip) can be re-used from track cache
+            if (state == DRAINING && storable && !preloaded && cache->level() == cache->total) {
+                uint64_t received = encoder->compressed() ? encoder->consumed() : totalIn.load();
+                complete = received * 1000 / (44100 * 4) + 1000 >= trackInfo.duration;
+            }
+            if (state == DRAINING && onEoS) onEoS(this);
+            state = DRAINED;
+            client.lingering = true;
+        } else if (!sent) {
+            // nothing to send for now, so wait for new data (unless it just came) or for peer to go away
+            std::scoped_lock lock(idleMutex);
+            if (seen != sequence) {
+                seen = sequence;
+                continue;
+            }
+            if (std::find(idleSocks.begin(), idleSocks.end(), sock) == idleSocks.end()) idleSocks.push_back(sock);
+            reactor.arm(sock, HTTPreactor::READ);
+            return;
         }
     }
 
-    isRunning = false;
+    reactor.arm(sock, HTTPreactor::READ | HTTPreactor::WRITE);
 }
 
 /* DLNA.ORG_CI: conversion indicator parameter (integer)
@@ -665,7 +1244,7 @@ typedef enum {
     DLNA_ORG_FLAG_DLNA_V15 = (1 << 20),
 } dlna_org_flags_t;
 
-char* makeDLNA_ORG(const char *codec, bool infiniteCache, bool live) {
+char* makeDLNA_ORG(const char *codec, bool infiniteCache, bool live, bool paced) {
     const char* DLNAOrgPN = "";
         
     if (!strcasecmp(codec, "mp3")) DLNAOrgPN = "DLNA.ORG_PN=MP3;";
@@ -682,7 +1261,9 @@ char* makeDLNA_ORG(const char *codec, bool infiniteCache, bool live) {
      * don't have access to it until we have received full content. As it is supposed to
      * represent what is accessible, not the media itself, we'll always set it. We can still use
      * partial cache, so b29 shall be set (then OP shall not be). If user has opted-out file
-     * cache (or no fake), we can only do b29. In any case, we don't support time-based seek */
+     * cache (or no fake), we can only do b29. Time-based seek is b30 (not OP) and it makes no
+     * sense when live. A time not encoded yet or not in cache anymore is served from the nearest
+     * point we have and the response tells the actual start */
     
      uint32_t org_op = infiniteCache ? DLNA_ORG_OPERATION_RANGE : 0;
      uint32_t org_flags = DLNA_ORG_FLAG_STREAMING_TRANSFERT_MODE | DLNA_ORG_FLAG_BACKGROUND_TRANSFERT_MODE |
@@ -691,6 +1272,8 @@ char* makeDLNA_ORG(const char *codec, bool infiniteCache, bool live) {
 
      if (live) org_flags |= DLNA_ORG_FLAG_S0_INCREASE;
      if (!infiniteCache) org_flags |= DLNA_ORG_FLAG_BYTE_BASED_SEEK;
+     if (!live) org_flags |= DLNA_ORG_FLAG_TIME_BASED_SEEK;
+     if (paced) org_flags |= DLNA_ORG_FLAG_SENDER_PACED;
 
      size_t n = snprintf(NULL, 0, "%sDLNA.ORG_OP=%02u;DLNA.ORG_CI=0;DLNA.ORG_FLAGS=%08x000000000000000000000000",
                               DLNAOrgPN, org_op, org_flags);
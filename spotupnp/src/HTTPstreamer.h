@@ -7,18 +7,26 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <deque>
+#include <span>
+#include <algorithm>
 #include <memory>
 #include <inttypes.h>
 #include <map>
 #include <functional>
 
-#include "BellTask.h"
 #include "TrackQueue.h"
 #ifdef _WIN32
 #include "win32shim.h"
 #endif
 
 #include "HTTPmode.h"
+#include "HTTPreactor.h"
+#include "HTTPserver.h"
+#include "memGovernor.h"
+#include "encoderPool.h"
+#include "pagePool.h"
 #include "metadata.h"
 #include "codecs.h"
 
@@ -30,13 +38,12 @@ typedef std::function<void(HTTPstreamer *self)> EoSCallback;
 
 /****************************************************************************************
  * Cache buffer 
+ *
+ * Data is addressed by its absolute offset since the beginning so that each reader has its
+ * own cursor and there is no shared read position
  */
 class cacheBuffer {
-private:
-    uint8_t* read_p, * write_p, * wrap_p;
-
 protected:
-    uint8_t* buffer;
     size_t size;
 
 public:
@@ -45,33 +52,56 @@ public:
     cacheBuffer(size_t size) : size(size) { }
     virtual ~cacheBuffer(void) { };
     virtual size_t level(void) = 0;
-    virtual size_t pending(void) = 0;
+    size_t oldest(void) { return total - level(); }
     virtual ssize_t scope(size_t offset) = 0;
-    virtual size_t read(uint8_t* dst, size_t max, size_t min = 0) = 0;
-    virtual uint8_t* readInner(size_t& size) = 0;
-    virtual void setOffset(size_t offset) = 0;
+    // data from offset towards total is made available in at most 2 contiguous segments (maybe not all)
+    virtual size_t peek(size_t offset, std::span<uint8_t> segments[2]) = 0;
+    // room for new data in a contiguous segment of at most size bytes, then committed
+    virtual uint8_t* reserve(size_t& size) = 0;
+    virtual void commit(size_t size) = 0;
     virtual void write(const uint8_t* src, size_t size) = 0;
     virtual void flush(void) = 0;
+    virtual size_t capacity(void) { return SIZE_MAX; }
+    // give back memory (keeping most recent data and all from keep), returns how much was freed
+    virtual size_t shrink(size_t wanted, size_t keep = SIZE_MAX) { return 0; }
+    // when supported, data is sent by the kernel to the socket without user-space copy
+    virtual bool zeroCopy(void) { return false; }
+    virtual ssize_t transmit(int sock, size_t offset, size_t size) { return -1; }
+    // when all data since start is still there, it is given away (buffer is empty after)
+    virtual std::vector<uint8_t*> takePages(void) { return {}; }
+    virtual FILE* takeFile(void) { return NULL; }
 };
 
 /****************************************************************************************
  * Ring buffer (always rolls over)
+ *
+ * Pages are taken from the shared pool as data arrives, up to size. Then the oldest page is
+ * re-used for new data so what rolls over goes by whole pages. Page n holds data at offsets
+ * from (first + n) * pageSize, pages go back to the pool on flush
  */
 class ringBuffer : public cacheBuffer {
 private:
-    uint8_t* read_p, * write_p, * wrap;
+    std::deque<uint8_t*> pages;
+    size_t first = 0;
+    std::string owner;
+
+    void release(size_t count);
 
 public:
-    ringBuffer(size_t size = 8 * 1024 * 1024);
-    ~ringBuffer(void) { delete[] buffer; }
-    size_t level(void) { return total < size ? total : size - 1; }  
-    size_t pending(void) { return write_p >= read_p ? write_p - read_p : wrap - read_p; }
+    static constexpr size_t minSize = 1024 * 1024;
+    // actual size depends on memory budget, owner is who is accounted for it
+    ringBuffer(std::string owner = "", size_t size = 8 * 1024 * 1024);
+    ~ringBuffer(void);
+    size_t level(void) { return total - std::min(total, first * pagePool::pageSize); }
     ssize_t scope(size_t offset);
-    size_t read(uint8_t* dst, size_t max, size_t min = 0);
-    uint8_t* readInner(size_t& size);
-    void setOffset(size_t offset);
+    size_t peek(size_t offset, std::span<uint8_t> segments[2]);
+    uint8_t* reserve(size_t& size);
+    void commit(size_t size) { total += size; }
     void write(const uint8_t* src, size_t size);
-    void flush(void) { read_p = write_p = buffer; total = 0; }
+    void flush(void);
+    size_t capacity(void) { return size; }
+    size_t shrink(size_t wanted, size_t keep = SIZE_MAX);
+    std::vector<uint8_t*> takePages(void);
 };
 
 /****************************************************************************************
@@ -80,48 +110,140 @@ public:
 class fileBuffer : public cacheBuffer {
 private:
     FILE* file;
-    size_t readOffset = 0;
+    size_t peekOffset = 0, peekLen = 0;
+    // what readers see of the file, and where writer prepares data
+    std::vector<uint8_t> window, stage;
+
+public:
+    fileBuffer(size_t size = 128 * 1024) : cacheBuffer(size), window(size) { file = tmpfile(); }
+    ~fileBuffer(void) { if (file) fclose(file); }
+    size_t level(void) { return total; }
+    ssize_t scope(size_t offset) { return offset >= total ? offset - total + 1 : 0; }
+    size_t peek(size_t offset, std::span<uint8_t> segments[2]);
+    uint8_t* reserve(size_t& size) { stage.resize(size); return stage.data(); }
+    void commit(size_t size) { write(stage.data(), size); }
+    void write(const uint8_t* src, size_t size);
+    void flush(void) { total = peekLen = 0; }
+#ifdef __linux__
+    bool zeroCopy(void) { return true; }
+#endif
+    ssize_t transmit(int sock, size_t offset, size_t size);
+    FILE* takeFile(void);
+};
+
+#ifndef _WIN32
+/****************************************************************************************
+ * Mapped file buffer
+ *
+ * The file grows by segments that are mapped once and never moved, so pointers to cached
+ * data stay valid for as long as the buffer exists and readers do not share file position
+ */
+class mapBuffer : public cacheBuffer {
+private:
+    FILE* file;
+    std::vector<uint8_t*> segments;
+    bool grow(void);
 
 public:
-    fileBuffer(size_t size = 128 * 1024) : cacheBuffer(size) { file = tmpfile(); buffer = new uint8_t[size]; }
-    ~fileBuffer(void) { fclose(file); delete[] buffer; }
+    mapBuffer(size_t size = 1024 * 1024);
+    ~mapBuffer(void);
     size_t level(void) { return total; }
-    size_t pending(void) { return total - readOffset; }
     ssize_t scope(size_t offset) { return offset >= total ? offset - total + 1 : 0; }
-    size_t read(uint8_t* dst, size_t max, size_t min = 0);
-    uint8_t* readInner(size_t& size);
-    void setOffset(size_t offset) { readOffset = offset >= 0 ? offset : 0; }
+    size_t peek(size_t offset, std::span<uint8_t> segments[2]);
+    uint8_t* reserve(size_t& size);
+    void commit(size_t size) { total += size; }
     void write(const uint8_t* src, size_t size);
-    void flush(void) { readOffset = total = 0; }
+    void flush(void) { total = 0; }
+#ifdef __linux__
+    bool zeroCopy(void) { return true; }
+#endif
+    ssize_t transmit(int sock, size_t offset, size_t size);
+    FILE* takeFile(void);
 };
+#endif
 
 /****************************************************************************************
  * Class to stream audio content with HTTP
  */
-class HTTPstreamer : public bell::Task {
+class HTTPstreamer : public std::enable_shared_from_this<HTTPstreamer>, public memGovernor::reclaimable, public encoderPool::job {
 private:
+    // what's to be sent is either bytes or a range of cache
+    struct outData {
+        std::string bytes;
+        size_t from = 0, cached = 0;
+    };
+
+    // each connection has its own cursor in cache so several can be served at the same time
+    struct client {
+        int sock;
+        std::vector<uint8_t> request;
+        std::deque<outData> out;
+        size_t outPos = 0, cursor = 0;
+        bool serving = false, lingering = false, chunked = false;
+        struct {
+            size_t interval = 0, remain = 0;
+            std::string trackId;
+        } icy;
+        struct {
+            uint64_t start = 0;
+            size_t sent = 0;
+            int wait = 0;
+        } pace;
+        client(int sock, std::vector<uint8_t>&& request) : sock(sock), request(std::move(request)) { }
+    };
+
     std::atomic<bool> isRunning = false;
-    std::mutex runningMutex;
-    std::string host;
+    std::mutex streamMutex;
+    HTTPreactor& reactor;
+    std::shared_ptr<HTTPserver> server;
     std::string streamUrl;
-    int listenSock = -1;
-    uint16_t port;
+    std::map<int, std::unique_ptr<client>> clients;
+    // clients waiting for data are notified when there is something new
+    std::mutex idleMutex;
+    std::vector<int> idleSocks;
+    std::atomic<uint32_t> sequence = 0;
     int64_t contentLength = HTTP_CL_NONE;
+    std::string codec;
     std::unique_ptr<baseCodec> encoder;
+    // encoding runs in encoder pool, it is done when all received audio is encoded and drained
+    std::mutex encodeMutex;
+    std::atomic<bool> encoded = false, listened = false;
+    // whole track is encoded in cache before responding, so that length is exact
+    std::atomic<bool> exact = false;
     std::unique_ptr<cacheBuffer> cache;
-    size_t useCache, scratchLen;
-    uint8_t *scratch;
-    bool flow, chunked;
+    size_t chunkLen;
+    std::string cacheKey;
+    // time (ms since start of stream) to offset in cache, for time-based seek
+    std::deque<std::pair<uint32_t, size_t>> timeIndex = { { 0, 0 } };
+    // offsets in cache where decoder can start (frames, pages), for what is still cached
+    std::deque<uint64_t> syncIndex = { 0 };
+    // set from encoder pool while audio thread feeds us
+    std::atomic<bool> preloaded = false, preloading = false;
+    bool preloadLength = false, requested = false, storable = false, complete = false;
+    bool flow;
     int cacheMode;
+    // burst of prefill seconds then real-time plus catchup percent
     struct {
-        size_t interval, remain;
-        size_t size, count;
-        std::string trackId;
-    } icy;
-
-    void runTask();
-    ssize_t streamBody(int sock, struct timeval& timeout);
-    ssize_t sendChunk(int sock, uint8_t* data, ssize_t size, bool count);
+        bool enabled = false;
+        uint32_t prefill = 0, catchup = 0;
+    } pacing;
+    double byteRate = 0;
+
+    bool connect(client& client);
+    void onClient(client& client, int events);
+    void closeClient(client& client);
+    int flushOut(client& client);
+    ssize_t gatherOut(client& client);
+    size_t produce(void);
+    void preload(void);
+    ssize_t seekTime(uint32_t& ms);
+    size_t snap(size_t offset);
+    void wake(void);
+    void report(void);
+    ssize_t streamBody(client& client);
+    size_t pace(client& client, size_t size);
+    void queue(client& client, std::string_view bytes);
+    void queueChunk(client& client, std::string_view bytes, size_t from = 0, size_t cached = 0);
     void getMetadata(cspot::TrackInfo& track, metadata_t* metadata);
     onHeadersHandler onHeaders;
     EoSCallback onEoS;
@@ -133,19 +255,29 @@ public:
     cspot::TrackInfo trackInfo;
     std::string trackUnique;
     int64_t offset;
-    inline static uint16_t portBase = 0, portRange = 1;
-    uint64_t totalIn = 0, totalOut = 0;
+    std::atomic<uint64_t> totalIn = 0, totalOut = 0;
+    inline static std::atomic<size_t> maxClients = 4;
+    // when set, encoder statistics of each track are appended there
+    inline static std::string statsFile;
+    // longest track (s) fully encoded before responding in exact content-length mode, 0 is no limit
+    inline static uint32_t exactMax = 900;
 
     HTTPstreamer(struct in_addr addr, std::string id, unsigned index, std::string codec, 
-                 bool flow, int64_t contentLength, int cacheMode,
+                 bool flow, int64_t contentLength, int cacheMode, std::string pacing,
                  cspot::TrackInfo track, std::string_view trackUnique, int32_t startOffset,
                  onHeadersHandler onHeaders, EoSCallback onEoS);
     ~HTTPstreamer();
+    void start(void);
+    void attach(int sock, std::vector<uint8_t>& request);
     void flush(void);
-    bool connect(int sock);
+    void drain(void);
     bool feedPCMFrames(const uint8_t* data, size_t size);
     std::string getStreamUrl(void) { return streamUrl; }
     void getMetadata(metadata_t* metadata);
     void setContentLength(int64_t contentLength);
     std::string trackId() { return trackInfo.trackId; }
+    size_t reclaim(size_t wanted);
+    int urgency(void);
+    bool encode(void);
+    double encodeSpeed(void);
 };
@@ -8,6 +8,8 @@
 #include <cassert>
 #include <cstdint>
 #include <cstring>
+#include <chrono>
+#include <algorithm>
 #include "Logger.h"
 #include "spotify.h"
 #include "metadata.h"
@@ -17,6 +19,7 @@
 #endif
 
 #include "codecs.h"
+#include "memGovernor.h"
 #include "FLAC/stream_encoder.h"
 #include "opusenc.h"
 #include "vorbis/vorbisfile.h"
@@ -30,72 +33,102 @@ extern "C" {
  * Ring buffer
  */
 
-byteBuffer::byteBuffer(FILE* storage, size_t size) {
-    buffer = new uint8_t[size];
+byteBuffer::byteBuffer(FILE* storage, size_t size, std::string owner) : owner(owner) {
+    // any write must fit so don't go too low
+    size = memGovernor::instance().acquire(owner, size, std::min(size, (size_t) 256 * 1024));
+    // budget can give any size but mirroring needs whole pages and chunks must be whole frames
+    size_t align = std::max(mirrorMemory::granularity(), (size_t) 64);
+    memGovernor::instance().release(owner, size % align);
+    size -= size % align;
+    memory = std::make_unique<mirrorMemory>(size);
+    buffer = memory->data();
+    extent = memory->extent();
     this->size = size;
-    this->write_p = this->read_p = buffer;
-    this->wrap_p = buffer + size; 
     this->storage = storage;
 }
 
 byteBuffer::~byteBuffer(void) { 
-    std::scoped_lock lock(mutex); 
-    delete[] buffer;
+    memGovernor::instance().release(owner, size);
     if (storage) fclose(storage);
 }
 
-size_t byteBuffer::read(uint8_t* dst, size_t size, size_t min) {
-    std::scoped_lock lock(mutex);
-    size = std::min(size, _used());
-    if (size < min) return 0;
+uint8_t* byteBuffer::reserve(size_t& size) {
+    uint64_t w = head.load(std::memory_order_relaxed);
+    size_t offset = w % this->size;
 
-    size_t cont = std::min(size, (size_t) (wrap_p - read_p));
-    memcpy(dst, read_p, cont);
-    memcpy(dst + cont, buffer, size - cont);
+    // 0 means as much as possible, but always contiguous
+    size_t room = std::min(this->size - (size_t) (w - tail.load(std::memory_order_acquire)), extent - offset);
+    size = size ? std::min(size, room) : room;
 
-    read_p += size;
-    if (read_p >= wrap_p) read_p -= this->size;
-    return size;
+    return size ? buffer + offset : NULL;
 }
 
-uint8_t* byteBuffer::readInner(size_t &size) {
-    // unless there is no enough data, we exit with mutex locked
-    mutex.lock();
-
-    // 0 means we want everything (contiguous)
-    if (!size) size = this->size;
+void byteBuffer::publish(size_t size, bool sync) {
+    uint64_t w = head.load(std::memory_order_relaxed);
 
-    // caller *must* consume ALL data
-    size = std::min(size, _used());
-    size = std::min(size, (size_t)(wrap_p - read_p));
-
-    if (!size) {
-        mutex.unlock();
-        return NULL;
+    if (sync && size) {
+        std::scoped_lock lock(marksMutex);
+        marks.push_back(w);
     }
 
-    uint8_t* r = read_p; 
-    read_p += size;
-    if (read_p >= wrap_p) read_p -= this->size;
-    
-    return r;
+    head.store(w + size, std::memory_order_release);
 }
 
-bool byteBuffer::write(const uint8_t* src, size_t size) {
-    std::scoped_lock lock(mutex);
-    if (size > _space()) return false;
+void byteBuffer::commit(size_t size, bool sync) {
+    // what has been reserved is contiguous
+    if (storage && size) fwrite(buffer + head.load(std::memory_order_relaxed) % this->size, size, 1, storage);
+    publish(size, sync);
+}
 
-    size_t cont = std::min(size, (size_t)(wrap_p - write_p));
-    memcpy(write_p, src, cont);
+bool byteBuffer::write(const uint8_t* src, size_t size, bool sync) {
+    if (size > space()) return false;
+
+    size_t offset = head.load(std::memory_order_relaxed) % this->size;
+    size_t cont = std::min(size, extent - offset);
+    memcpy(buffer + offset, src, cont);
     memcpy(buffer, src + cont, size - cont);
 
     if (storage) fwrite(src, size, 1, storage);
-
-    write_p += size;
-    if (write_p >= wrap_p) write_p -= this->size;
+    publish(size, sync);
     return true;
 }
 
+uint8_t* byteBuffer::peek(size_t& size) {
+    uint64_t r = tail.load(std::memory_order_relaxed);
+    size_t offset = r % this->size;
+
+    // 0 means everything available, but always contiguous
+    size_t avail = std::min((size_t) (head.load(std::memory_order_acquire) - r), extent - offset);
+    size = size ? std::min(size, avail) : avail;
+
+    return size ? buffer + offset : NULL;
+}
+
+size_t byteBuffer::read(uint8_t* dst, size_t size, size_t min) {
+    uint64_t r = tail.load(std::memory_order_relaxed);
+    size = std::min(size, (size_t) (head.load(std::memory_order_acquire) - r));
+    if (!size || size < min) return 0;
+
+    size_t offset = r % this->size;
+    size_t cont = std::min(size, extent - offset);
+    memcpy(dst, buffer + offset, cont);
+    memcpy(dst + cont, buffer, size - cont);
+
+    tail.store(r + size, std::memory_order_release);
+    return size;
+}
+
+void byteBuffer::flush(void) { 
+    std::scoped_lock lock(marksMutex);
+    head = tail = 0;
+    marks.clear(); 
+}
+
+void byteBuffer::syncs(uint64_t before, std::deque<uint64_t>& points) {
+    std::scoped_lock lock(marksMutex);
+    for (; !marks.empty() && marks.front() < before; marks.pop_front()) points.push_back(marks.front());
+}
+
 #ifdef __GNUC__
 #define PACK( __Declaration__ ) __attribute__((__packed__)) __Declaration__ 
 #endif
@@ -124,34 +157,24 @@ baseCodec::baseCodec(codecSettings settings, std::string mimeType, bool store) :
 
     icyInterval = 16 * 1024;
     pcmBitrate = settings.rate * settings.channels * settings.size * 8;
-    pcm = std::make_shared<byteBuffer>(storage);
+    pcm = std::make_shared<byteBuffer>(storage, 4 * 1024 * 1024, settings.owner);
     encoded = pcm;
 }
 
-size_t baseCodec::read(uint8_t* dst, size_t size, size_t min, bool drain) { 
-    // we want to encode more than required but not too much to leave some CPU
-    process(size * 2);
-    size_t bytes = encoded->read(dst, size, min);
+void baseCodec::encode(size_t bytes) {
+    auto now = [] { return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); };
+    uint64_t start = now();
+    if (!stats.started) stats.started = start;
 
-    if (!bytes && drain) {
-        baseCodec::drain();
-        return encoded->read(dst, size, min);
-    } else {
-        return bytes;
-    }
-}
+    process(bytes);
 
-uint8_t* baseCodec::readInner(size_t& size, bool drain) { 
-    // we want to encode more than required but not too much to leave some CPU
-    process(size * 2);
-    uint8_t * data = encoded->readInner(size);
+    uint64_t end = now();
+    stats.busy += end - start;
+    if (!stats.firstByte && encoded->produced()) stats.firstByte = end - stats.started;
+}
 
-    if (!data && drain) {
-        baseCodec::drain();
-        return encoded->readInner(size);
-    } else {
-        return data;
-    }
+size_t baseCodec::read(uint8_t* dst, size_t size, size_t min) { 
+    return encoded->read(dst, size, min);
 }
 
 std::string baseCodec::id(void) {
@@ -169,8 +192,8 @@ class pcmCodec : public::baseCodec {
 public:
     pcmCodec(codecSettings settings, bool store = false);
     virtual int64_t initialize(int64_t duration) { return duration ? (((int64_t)pcmBitrate * duration) / (8 * 1000)) & ~1LL : -INT64_MAX; }
-    virtual size_t read(uint8_t* dst, size_t size, size_t min, bool drain);
-    virtual uint8_t* readInner(size_t& size, bool drain);
+    virtual size_t read(uint8_t* dst, size_t size, size_t min);
+    virtual size_t blockAlign(void) { return settings.channels * settings.size; }
 };
 
 pcmCodec::pcmCodec(codecSettings settings, bool store) :
@@ -180,38 +203,11 @@ pcmCodec::pcmCodec(codecSettings settings, bool store) :
                ";channels=" + std::to_string(settings.channels);
 }
 
-uint8_t* pcmCodec::readInner(size_t& size, bool drain) {
-    uint8_t* data = pcm->readInner(size);
-
-    // will only locked if not empty
-    if (!size) return NULL;
-
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-    // pcm needs byte swapping on little endian CPU
-    uint16_t* swap = (uint16_t*)data;
-    for (size_t i = size / settings.size; i; i--) {
-#ifdef _WIN32
-        * swap++ = _byteswap_ushort(*swap);
-#else
-        * swap++ = __builtin_bswap16(*swap);
-#endif
-    }
-#endif
-    return data;
-}
-
-size_t pcmCodec::read(uint8_t* dst, size_t size, size_t min, bool drain) {
+size_t pcmCodec::read(uint8_t* dst, size_t size, size_t min) {
     size_t bytes = encoded->read(dst, size, min);
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
     // pcm needs byte swapping on little endian CPU
-    uint16_t* swap = (uint16_t*) dst;
-    for (int i = bytes / settings.size; i; i--) {
-#ifdef _WIN32
-        * swap++ = _byteswap_ushort(*swap);
-#else
-        * swap++ = __builtin_bswap16(*swap);
-#endif
-    }
+    kernels.byteswap((uint16_t*) dst, bytes / settings.size);
 #endif
     return bytes;
 }
@@ -227,6 +223,8 @@ private:
 public:
     wavCodec(codecSettings settings, bool store = false) : baseCodec(settings, "audio/wav", store) { icyInterval = 128 * 1024; }
     virtual int64_t initialize(int64_t duration);
+    // header is a multiple of block size
+    virtual size_t blockAlign(void) { return settings.channels * settings.size; }
 };
 
 int64_t wavCodec::initialize(int64_t duration) {
@@ -279,6 +277,117 @@ int64_t wavCodec::initialize(int64_t duration) {
     return (length + sizeof(header)) * (duration ? 1 : -1);
 }
 
+/****************************************************************************************
+ * OGG passthrough codec
+ * 
+ * Spotify's Ogg Vorbis is forwarded as-is, by complete pages so that HTTP can start at any 
+ * of them. Vorbis header pages are kept so they can be re-sent when a seek restarts the 
+ * stream in the middle of the file. Timeline is given by pages' granule position. Received
+ * data goes through the input buffer like PCM does, so pages are only built and written by
+ * the encoding thread
+ */
+
+class oggCodec : public::baseCodec {
+private:
+    std::vector<uint8_t> pending, headers;
+    bool collecting = false, started = false;
+    int64_t base = -1, granule = 0;
+
+    size_t pageSize(void);
+    bool writePages(void);
+    void process(size_t bytes);
+
+public:
+    oggCodec(codecSettings settings, bool store = false);
+    virtual int64_t initialize(int64_t duration) { return -(duration ? ((int64_t)settings.vorbis.bitrate * duration) / 8 : INT64_MAX); }
+    virtual bool drain(void) { return writePages() && pending.empty(); }
+    virtual void flush(void);
+    virtual bool compressed(void) { return true; }
+    virtual uint64_t consumed(void) { return (granule - std::max(base, (int64_t) 0)) * settings.channels * settings.size; }
+};
+
+oggCodec::oggCodec(codecSettings settings, bool store) : baseCodec(settings, "audio/ogg", store) {
+    pcm.reset();
+    pcm = std::make_shared<byteBuffer>(nullptr, 1024 * 1024, settings.owner);
+}
+
+void oggCodec::flush(void) {
+    baseCodec::flush();
+    pending.clear();
+    started = collecting = false;
+    base = -1;
+    granule = 0;
+}
+
+size_t oggCodec::pageSize(void) {
+    // returns the size of first page when it's complete
+    if (pending.size() < 27) return 0;
+    size_t size = 27 + pending[26];
+    if (pending.size() < size) return 0;
+    for (int i = 0; i < pending[26]; i++) size += pending[27 + i];
+    return pending.size() >= size ? size : 0;
+}
+
+bool oggCodec::writePages(void) {
+    // returns false when stopped because encoded buffer is full
+    for (size_t size; (size = pageSize()) != 0; ) {
+        uint8_t* page = pending.data();
+        int64_t position = 0;
+        for (int i = 7; i >= 0; i--) position = (position << 8) | page[6 + i];
+        bool bos = page[5] & 0x02;
+
+        // a stream that does not start with a BOS page needs headers first (e.g. after seek)
+        if (!started && !bos && !headers.empty()) {
+            if (encoded->space() < headers.size() + size) return false;
+            encoded->write(headers.data(), headers.size(), true);
+        } else if (encoded->space() < size) {
+            return false;
+        }
+
+        // header pages have a granule of 0, keep them for further restarts
+        if (bos) {
+            headers.clear();
+            collecting = true;
+        }
+        if (collecting && position == 0) headers.insert(headers.end(), page, page + size);
+        else collecting = false;
+
+        // timeline starts at track's beginning or at first page after a seek (-1 means no packet ends here)
+        if (!started) base = bos ? 0 : -1;
+        if (position > 0) {
+            if (base < 0) base = position;
+            granule = position;
+        }
+
+        encoded->write(page, size, true);
+        pending.erase(pending.begin(), pending.begin() + size);
+        started = true;
+    }
+
+    return true;
+}
+
+void oggCodec::process(size_t bytes) {
+    // let complete pages go, received data waits in input buffer while there is no room
+    if (!writePages()) return;
+
+    uint8_t* data = pcm->peek(bytes);
+    if (!bytes) return;
+    pending.insert(pending.end(), data, data + bytes);
+    pcm->consume(bytes);
+
+    // skip whatever is before the capture pattern (Spotify has its own header)
+    static const uint8_t capture[] = { 'O', 'g', 'g', 'S' };
+    auto sync = std::search(pending.begin(), pending.end(), capture, capture + sizeof(capture));
+    if (sync != pending.begin()) {
+        size_t keep = std::min(pending.size(), sizeof(capture) - 1);
+        if (sync == pending.end()) sync = pending.end() - keep;
+        pending.erase(pending.begin(), sync);
+    }
+
+    writePages();
+}
+
 /****************************************************************************************
  * FLAC codec
  */
@@ -287,15 +396,23 @@ class flacCodec : public::baseCodec {
 private:
     FLAC__StreamEncoder* flac = NULL;
     bool drained = false;
+    std::vector<FLAC__int32> samples;
+
+    void process(size_t bytes);
 
 public:
-    flacCodec(codecSettings settings, bool store = false) : baseCodec(settings, "audio/flac", store) { icyInterval = 128 * 1024; }
+    flacCodec(codecSettings settings, bool store = false);
     virtual ~flacCodec(void);
     virtual int64_t initialize(int64_t duration);
-    virtual bool pcmWrite(const uint8_t* data, size_t size);
-    virtual void drain(void);
+    virtual bool drain(void);
 };
 
+flacCodec::flacCodec(codecSettings settings, bool store) : baseCodec(settings, "audio/flac", store) { 
+    icyInterval = 128 * 1024;
+    pcm.reset();
+    pcm = std::make_shared<byteBuffer>(nullptr, 4 * 1024 * 1024, settings.owner);
+}
+
 flacCodec::~flacCodec(void) {
     if (flac) FLAC__stream_encoder_delete((FLAC__StreamEncoder*)flac);
 }
@@ -307,7 +424,8 @@ int64_t flacCodec::initialize(int64_t duration) {
 
     auto flacWrite = [](const FLAC__StreamEncoder* encoder, const FLAC__byte buffer[],
         size_t bytes, unsigned samples, unsigned current_frame, void* client_data) {
-            if (((flacCodec*)client_data)->encoded->write(buffer, bytes)) return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+            // metadata are written with no samples, frames are written at once
+            if (((flacCodec*)client_data)->encoded->write(buffer, bytes, samples)) return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
             else return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
     };
 
@@ -328,22 +446,30 @@ int64_t flacCodec::initialize(int64_t duration) {
     return -(duration ? (pcmBitrate * duration * ratio[settings.flac.level]) / (8 * 1000) : INT64_MAX);
 }
 
-bool flacCodec::pcmWrite(const uint8_t* data, size_t len) {
-    if (encoded->space() < std::max(len * 2, minSpace)) return false;
-    //assert((size & 0x03) != 0);
+void flacCodec::process(size_t bytes) {
+    size_t frameSize = settings.channels * settings.size;
 
-    auto flacSamples = new FLAC__int32[len];
-    for (size_t i = 0; i < len / settings.size; i++, data += settings.size) flacSamples[i] = *(int16_t*)data;
-    FLAC__stream_encoder_process_interleaved((FLAC__StreamEncoder*)flac, flacSamples, len / (settings.size * settings.channels));
-    delete[] flacSamples;
+    while (pcm->used() >= frameSize && (ssize_t)bytes > 0) {
+        // by blocks of at most 4096 frames, always aligned on frames
+        size_t len = std::min(pcm->used(), 4096 * frameSize) / frameSize * frameSize;
+        if (encoded->space() < std::max(len * 2, minSpace)) break;
 
-    return true;
+        uint8_t* data = pcm->peek(len);
+        samples.resize(len / settings.size);
+        kernels.widen((int16_t*) data, samples.data(), samples.size());
+        pcm->consume(len);
+
+        FLAC__stream_encoder_process_interleaved((FLAC__StreamEncoder*)flac, samples.data(), len / frameSize);
+        // don't need to be exact on produced bytes
+        bytes -= len / 2;
+    }
 }
 
-void flacCodec::drain(void) {
-    if (drained) return;
+bool flacCodec::drain(void) {
+    if (drained || encoded->space() < minSpace) return drained;
     FLAC__stream_encoder_finish((FLAC__StreamEncoder*)flac);
     drained = true;
+    return true;
 }
 
 /****************************************************************************************
@@ -364,12 +490,12 @@ public:
     aacCodec(codecSettings settings, bool store = false);
     virtual ~aacCodec(void) { cleanup(); }
     virtual int64_t initialize(int64_t duration);
-    virtual void drain(void);
+    virtual bool drain(void);
 };
 
 aacCodec::aacCodec(codecSettings settings, bool store) : baseCodec(settings, "audio/aac", false) {
     pcm.reset();
-    pcm = std::make_shared<byteBuffer>();
+    pcm = std::make_shared<byteBuffer>(nullptr, 4 * 1024 * 1024, settings.owner);
 }
 
 void aacCodec::cleanup(void) {
@@ -407,18 +533,27 @@ int64_t aacCodec::initialize(int64_t duration) {
 void aacCodec::process(size_t bytes) {
     size_t blockSize = inSamples * settings.size;
     while (encoded->space() >= outMaxBytes && pcm->used() >= blockSize && (ssize_t)bytes > 0) {
-        pcm->read(inBuf, blockSize);
-        int len = faacEncEncode(aac, (int32_t*) inBuf, inSamples, outBuf, outMaxBytes);
-        encoded->write(outBuf, len);
+        // work in-place unless buffers wrap
+        size_t inSize = blockSize, outSize = outMaxBytes;
+        uint8_t* in = pcm->peek(inSize);
+        uint8_t* out = encoded->reserve(outSize);
+        if (inSize < blockSize) in = inBuf, pcm->read(inBuf, blockSize);
+        if (outSize < outMaxBytes) out = outBuf;
+
+        int len = faacEncEncode(aac, (int32_t*) in, inSamples, out, outMaxBytes);
+        if (in != inBuf) pcm->consume(blockSize);
+        if (out == outBuf) encoded->write(outBuf, len, true);
+        else encoded->commit(len, true);
         bytes -= len;
     }
 }
 
-void aacCodec::drain(void) {
-    if (drained || encoded->space() < outMaxBytes) return;
+bool aacCodec::drain(void) {
+    if (drained || encoded->space() < outMaxBytes) return drained;
     int len = faacEncEncode(aac, NULL, 0, outBuf, outMaxBytes);
-    encoded->write(outBuf, len);
+    encoded->write(outBuf, len, true);
     drained = true;
+    return true;
 }
 
 /****************************************************************************************
@@ -439,13 +574,13 @@ public:
     mp3Codec(codecSettings settings, bool store = false);
     virtual ~mp3Codec(void) { cleanup(); }
     virtual int64_t initialize(int64_t duration);
-    virtual void drain(void);
+    virtual bool drain(void);
     virtual std::string id() { return std::string("mp3"); }
 };
 
 mp3Codec::mp3Codec(codecSettings settings, bool store) : baseCodec(settings, "audio/mpeg", store) {
     pcm.reset();
-    pcm = std::make_shared<byteBuffer>();
+    pcm = std::make_shared<byteBuffer>(nullptr, 4 * 1024 * 1024, settings.owner);
 }
 
 void mp3Codec::cleanup(void) {
@@ -507,19 +642,25 @@ void mp3Codec::process(size_t bytes) {
     auto space = std::max(blockSize, minSpace);
     int len;
     while (encoded->space() >= space && pcm->used() >= blockSize && (ssize_t) bytes > 0) {
-        pcm->read((uint8_t*)scratch, blockSize);
-        uint8_t* coded = shine_encode_buffer_interleaved(mp3, scratch, &len);
-        encoded->write(coded, len);
+        // encode from pcm buffer directly unless it wraps
+        size_t size = blockSize;
+        int16_t* data = (int16_t*) pcm->peek(size);
+        if (size < blockSize) data = scratch, pcm->read((uint8_t*)scratch, blockSize);
+
+        uint8_t* coded = shine_encode_buffer_interleaved(mp3, data, &len);
+        if (data != scratch) pcm->consume(blockSize);
+        encoded->write(coded, len, true);
         bytes -= len;
     }
 }
 
-void mp3Codec::drain(void) {
-    if (drained || encoded->space() < std::max(blockSize, minSpace)) return;
+bool mp3Codec::drain(void) {
+    if (drained || encoded->space() < std::max(blockSize, minSpace)) return drained;
     int len;
     uint8_t* coded = shine_flush(mp3, &len);
-    encoded->write(coded, len);
+    encoded->write(coded, len, true);
     drained = true;
+    return true;
 }
 
 /****************************************************************************************
@@ -530,16 +671,22 @@ class opusCodec : public::baseCodec {
 private:
     OggOpusEnc* opus = NULL;
     bool drained = false;
+
+    void process(size_t bytes);
     
 public:
-    opusCodec(codecSettings settings, bool store = false) : baseCodec(settings, "audio/ogg;codecs=opus", store) { }
+    opusCodec(codecSettings settings, bool store = false);
     virtual ~opusCodec(void);
     virtual int64_t initialize(int64_t duration);
-    virtual bool pcmWrite(const uint8_t* data, size_t size);
-    virtual void drain(void);
+    virtual bool drain(void);
     virtual std::string id() { return std::string("ops"); }
 };
 
+opusCodec::opusCodec(codecSettings settings, bool store) : baseCodec(settings, "audio/ogg;codecs=opus", store) {
+    pcm.reset();
+    pcm = std::make_shared<byteBuffer>(nullptr, 4 * 1024 * 1024, settings.owner);
+}
+
 opusCodec::~opusCodec(void) {
     if (opus) ope_encoder_destroy(opus);
 }
@@ -551,7 +698,8 @@ int64_t opusCodec::initialize(int64_t duration) {
 
     OpusEncCallbacks callbacks = {
         .write = [](void* user_data, const unsigned char* ptr, opus_int32 len) {
-                    return ((opusCodec*)user_data)->encoded->write(ptr, len) ? 0 : 1;
+                    // always called with full pages
+                    return ((opusCodec*)user_data)->encoded->write(ptr, len, true) ? 0 : 1;
         }, 
         .close = [](void* user_data) {
                     return 0;
@@ -568,20 +716,32 @@ int64_t opusCodec::initialize(int64_t duration) {
     int bitrate = settings.opus.bitrate * 1000;
     if (bitrate) ope_encoder_ctl(opus, OPUS_SET_BITRATE(bitrate));
     else ope_encoder_ctl(opus, OPUS_GET_BITRATE(&bitrate));
+    if (settings.opus.complexity >= 0) ope_encoder_ctl(opus, OPUS_SET_COMPLEXITY(settings.opus.complexity));
    
     return -(duration ? ((int64_t)bitrate * duration) / 8 : INT64_MAX);
 }
 
-bool opusCodec::pcmWrite(const uint8_t * data, size_t len) {
-    // we do not block (at least it should not happen)
-    if (encoded->space() < std::max(len * 2, minSpace)) return false;
-    return ope_encoder_write(opus, (opus_int16*)data, len / (settings.channels * settings.size)) == 0;
+void opusCodec::process(size_t bytes) {
+    size_t frameSize = settings.channels * settings.size;
+
+    while (pcm->used() >= frameSize && (ssize_t)bytes > 0) {
+        // by blocks of at most 4096 frames, always aligned on frames
+        size_t len = std::min(pcm->used(), 4096 * frameSize) / frameSize * frameSize;
+        if (encoded->space() < std::max(len * 2, minSpace)) break;
+
+        opus_int16* data = (opus_int16*) pcm->peek(len);
+        ope_encoder_write(opus, data, len / frameSize);
+        pcm->consume(len);
+        // don't need to be exact on produced bytes
+        bytes -= len / 8;
+    }
 }
 
-void opusCodec::drain(void) {
-    if (drained || encoded->space() < minSpace) return;
+bool opusCodec::drain(void) {
+    if (drained || encoded->space() < minSpace) return drained;
     ope_encoder_drain(opus);
     drained = true;
+    return true;
 }
 
 /****************************************************************************************
@@ -606,13 +766,13 @@ public:
     vorbisCodec(codecSettings settings, bool store = false);
     virtual ~vorbisCodec(void) { cleanup(); }
     virtual int64_t initialize(int64_t duration);
-    virtual void drain(void);
+    virtual bool drain(void);
     virtual std::string id() { return std::string("oga"); }
 };
 
 vorbisCodec::vorbisCodec(codecSettings settings, bool store) : baseCodec(settings, "audio/ogg;codecs=vorbis", store) {
     pcm.reset();
-    pcm = std::make_shared<byteBuffer>();
+    pcm = std::make_shared<byteBuffer>(nullptr, 4 * 1024 * 1024, settings.owner);
 }
 
 void vorbisCodec::cleanup(void) {
@@ -655,7 +815,7 @@ int64_t vorbisCodec::initialize(int64_t duration) {
         ogg_page page;
         ogg_stream_packetin(&stream, packets + i);
         ogg_stream_pageout(&stream, &page);
-        encoded->write(page.header, page.header_len);
+        encoded->write(page.header, page.header_len, true);
         encoded->write(page.body, page.body_len);
     }
 
@@ -669,15 +829,12 @@ void vorbisCodec::process(size_t bytes) {
     while (encoded->space() >= minSpace && pcm->used() > 1024 * settings.channels * settings.size && (ssize_t)bytes > 0) {
         size_t len = 1024 * settings.channels * settings.size;
         // we are always aligned on settings.channels * settings.size;
-        int16_t *data = (int16_t*) pcm->readInner(len);
+        int16_t *data = (int16_t*) pcm->peek(len);
         len /= settings.channels * settings.size;
 
         float** buffer = vorbis_analysis_buffer(&dsp, len);
-        for (size_t i = 0; i < len; i++) {
-            buffer[0][i] = *data++ / (float) INT16_MAX;
-            buffer[1][i] = *data++ / (float) INT16_MAX;
-        }
-        pcm->unlock();
+        kernels.deinterleave(data, buffer[0], buffer[1], len, 1.0f / INT16_MAX);
+        pcm->consume(len * settings.channels * settings.size);
         vorbis_analysis_wrote(&dsp, len);
 
         // encode as many blocks as possible
@@ -694,7 +851,7 @@ void vorbisCodec::process(size_t bytes) {
 
                 // get as many pages as possible (we assume we won't write more than space here...)
                 while (ogg_stream_pageout(&stream, &page)) {
-                    encoded->write(page.header, page.header_len);
+                    encoded->write(page.header, page.header_len, true);
                     encoded->write(page.body, page.body_len);
                     // don't need to be exact on written bytes
                     bytes -= page.header_len + page.body_len;
@@ -704,17 +861,18 @@ void vorbisCodec::process(size_t bytes) {
     }
 }
 
-void vorbisCodec::drain(void) {
-    if (drained || encoded->space() < minSpace) return;
+bool vorbisCodec::drain(void) {
+    if (drained || encoded->space() < minSpace) return drained;
 
     ogg_page page;
 
     if (ogg_stream_flush(&stream, &page)) {
-        encoded->write(page.header, page.header_len);
+        encoded->write(page.header, page.header_len, true);
         encoded->write(page.body, page.body_len);
     }
 
     drained = true;
+    return true;
 }
 
 /****************************************************************************************
@@ -725,6 +883,7 @@ std::unique_ptr<baseCodec> createCodec(codecSettings::type codec, codecSettings
     switch (codec) {
     case codecSettings::PCM: return std::make_unique<pcmCodec>(settings, store);
     case codecSettings::WAV: return std::make_unique<wavCodec>(settings, store);
+    case codecSettings::OGG: return std::make_unique<oggCodec>(settings, store);
     case codecSettings::FLAC: return std::make_unique<flacCodec>(settings, store);
     case codecSettings::OPUS: return std::make_unique<opusCodec>(settings, store);
     case codecSettings::VORBIS: return std::make_unique<vorbisCodec>(settings, store);
@@ -733,3 +892,47 @@ std::unique_ptr<baseCodec> createCodec(codecSettings::type codec, codecSettings
     default: return nullptr;
     }
 }
+
+std::unique_ptr<baseCodec> createCodec(const std::string& codec, codecSettings settings, bool store) {
+    if (codec.find("pcm") != std::string::npos) {
+        return createCodec(codecSettings::PCM, settings, store);
+    } else if (codec.find("wav") != std::string::npos) {
+        return createCodec(codecSettings::WAV, settings, store);
+    } else if (codec.find("ogg") != std::string::npos) {
+        (void)!sscanf(codec.c_str(), "%*[^:]:%d", &settings.vorbis.bitrate);
+        return createCodec(codecSettings::OGG, settings, store);
+    } else if (codec.find("flac") != std::string::npos || codec.find("flc") != std::string::npos) {
+        (void)!sscanf(codec.c_str(), "%*[^:]:%d", &settings.flac.level);
+        return createCodec(codecSettings::FLAC, settings, store);
+    } else if (codec.find("opus") != std::string::npos) {
+        (void)!sscanf(codec.c_str(), "%*[^:]:%d:%d", &settings.opus.bitrate, &settings.opus.complexity);
+        return createCodec(codecSettings::OPUS, settings, store);
+    } else if (codec.find("vorbis") != std::string::npos) {
+        (void)!sscanf(codec.c_str(), "%*[^:]:%d", &settings.vorbis.bitrate);
+        return createCodec(codecSettings::VORBIS, settings, store);
+    } else if (codec.find("aac") != std::string::npos) {
+        (void)!sscanf(codec.c_str(), "%*[^:]:%d", &settings.aac.bitrate);
+        return createCodec(codecSettings::AAC, settings, store);
+    } else if (codec.find("mp3") != std::string::npos) {
+        (void) !sscanf(codec.c_str(), "%*[^:]:%d", &settings.mp3.bitrate);
+        return createCodec(codecSettings::MP3, settings, store);
+    } else throw std::runtime_error("unknown codec");
+}
+
+std::string scaleCodec(const std::string& codec, int steps) {
+    /* Only FLAC level and Opus complexity change the cost without changing format, 
+     * so mime type announced to player remains valid. Others can't be scaled */
+    if (!steps) return codec;
+    
+    if (codec.find("flac") != std::string::npos || codec.find("flc") != std::string::npos) {
+        int level = 5;
+        (void)!sscanf(codec.c_str(), "%*[^:]:%d", &level);
+        return codec.substr(0, codec.find(':')) + ":" + std::to_string(std::max(0, level - 3 * steps));
+    } else if (codec.find("opus") != std::string::npos) {
+        int bitrate = 0, complexity = 10;
+        (void)!sscanf(codec.c_str(), "%*[^:]:%d:%d", &bitrate, &complexity);
+        return "opus:" + std::to_string(bitrate) + ":" + std::to_string(std::max(0, complexity - 3 * steps));
+    }
+
+    return codec;
+}
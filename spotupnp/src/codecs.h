@@ -1,39 +1,63 @@
 #pragma once
 
 #include <vector>
+#include <deque>
+#include <string>
 #include <inttypes.h>
 #include <mutex>
+#include <atomic>
+#include <memory>
+
+#include "mirrorMemory.h"
+#include "sampleKernels.h"
 
 /****************************************************************************************
  * Ring buffer
+ * 
+ * Single producer / single consumer: one thread writes (reserve/commit or write) and one 
+ * thread reads (peek/consume or read), neither take a lock. Positions are free running 
+ * counters so that full and empty are never ambiguous. Only flush() requires both sides 
+ * to be idle. Memory is mirrored when possible so reserve and peek never stop at the wrap.
  */
 class byteBuffer {
 private:
+    std::unique_ptr<mirrorMemory> memory;
     uint8_t* buffer;
-    uint8_t* read_p, * write_p, * wrap_p;
-    size_t size;
-    std::mutex mutex;
+    size_t size, extent;
+    std::atomic<uint64_t> head = 0, tail = 0;
     FILE* storage;
+    std::string owner;
+    std::mutex marksMutex;
+    std::deque<uint64_t> marks;
 
-    size_t _space(void) { return size - _used() - 1; }
-    size_t _used(void) { return write_p >= read_p ? write_p - read_p : size - (read_p - write_p); }
+    void publish(size_t size, bool sync);
 
 public:
-    byteBuffer(FILE* storage = NULL, size_t size = 4 * 1024 * 1024);
+    // actual size depends on memory budget, owner is who is accounted for it
+    byteBuffer(FILE* storage = NULL, size_t size = 4 * 1024 * 1024, std::string owner = "");
     ~byteBuffer(void);
+    // producer side: get contiguous room (size is in/out) then commit what has been written
+    uint8_t* reserve(size_t& size);
+    void commit(size_t size, bool sync = false);
+    // sync means that a decoder can start from there
+    bool write(const uint8_t* src, size_t size, bool sync = false);
+    // consumer side: get contiguous data (size is in/out, 0 means all) then consume what has been used
+    uint8_t* peek(size_t& size);
+    void consume(size_t size) { tail.store(tail.load(std::memory_order_relaxed) + size, std::memory_order_release); }
     size_t read(uint8_t* dst, size_t max, size_t min = 0);
-    uint8_t* readInner(size_t& size);
-    bool write(const uint8_t* src, size_t size);
-    size_t space(void) { std::scoped_lock lock(mutex); return _space(); }
-    size_t used(void) { std::scoped_lock lock(mutex); return _used(); }
-    void flush(void) { std::scoped_lock lock(mutex); read_p = write_p = buffer; }
-    void lock(void) { mutex.lock(); }
-    void unlock(void) { mutex.unlock(); }
+    size_t used(void) { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    size_t space(void) { return size - used(); }
+    // bytes written and read since flush
+    uint64_t produced(void) { return head.load(std::memory_order_acquire); }
+    uint64_t consumed(void) { return tail.load(std::memory_order_acquire); }
+    void flush(void);
+    void syncs(uint64_t before, std::deque<uint64_t>& points);
 };
 
 class codecSettings {
 public:
-    typedef enum { MP3, AAC, VORBIS, OPUS, FLAC, WAV, PCM } type;
+    typedef enum { MP3, AAC, VORBIS, OPUS, FLAC, WAV, PCM, OGG } type;
+    std::string owner;
     uint32_t rate = 44100;
     uint8_t channels = 2, size = 2;
     struct {
@@ -41,6 +65,7 @@ public:
     } flac;
     struct {
        int bitrate = 0;
+       int complexity = -1;
     } opus;
     struct {
         int bitrate = 224;
@@ -54,6 +79,9 @@ public:
 /* 
  Note that the whole implementation assumes that every buffer of samples contains 
  a set of full frames (i.e. a multiply of 16 bits L+R = 4 bytes
+
+ PCM is written by one thread, encoding (encode/drain) is done by another one and 
+ encoded data is read by a third one. Raw codecs have no encoding, they read PCM
  */
 class baseCodec {
 private:
@@ -64,7 +92,12 @@ protected:
     static size_t minSpace;
     uint32_t pcmBitrate;
     std::shared_ptr<byteBuffer> pcm, encoded;
+    const sampleKernels& kernels = sampleKernels::instance();
     int total = 0;
+    // time spent encoding and from first encode to first output since flush (µs)
+    struct encodeStats {
+        uint64_t busy = 0, started = 0, firstByte = 0;
+    } stats;
 
     virtual void process(size_t bytes) { }
     virtual void cleanup() { }
@@ -76,14 +109,34 @@ public:
     baseCodec(codecSettings settings, std::string mimeType, bool store = false);
     virtual ~baseCodec(void) { }
     virtual bool pcmWrite(const uint8_t* data, size_t size) { return pcm->write(data, size); }
-    void unlock(void) { encoded->unlock(); }
     bool isEmpty(void) { return encoded->used(); }
-    virtual void flush(void) { total = 0;  pcm->flush(); encoded->flush(); }
+    bool transcodes(void) { return pcm != encoded; }
+    // size of produced data is not proportional to PCM
+    virtual bool compressed(void) { return transcodes(); }
+    // PCM received but not yet encoded and encoded data not yet read
+    size_t pending(void) { return pcm->used(); }
+    size_t backlog(void) { return encoded->used(); }
+    // PCM taken by and data produced by encoder, since flush
+    virtual uint64_t consumed(void) { return pcm->consumed(); }
+    uint64_t produced(void) { return encoded->produced(); }
+    virtual void flush(void) { total = 0; stats = {}; pcm->flush(); encoded->flush(); }
     virtual int64_t initialize(int64_t duration) = 0;
-    virtual size_t read(uint8_t* dst, size_t size, size_t min = 0, bool drain = false);
-    virtual uint8_t* readInner(size_t& size, bool drain = false);
-    virtual void drain(void) { }
+    // encode until about bytes have been produced (or not enough PCM or room)
+    void encode(size_t bytes);
+    // seconds of audio encoded per second of work (0 when unknown) and ms until first output
+    double speed(void) { return stats.busy ? (double) consumed() * 8 * 1E6 / pcmBitrate / stats.busy : 0; }
+    uint32_t latency(void) { return stats.firstByte / 1000; }
+    virtual size_t read(uint8_t* dst, size_t size, size_t min = 0);
+    // once all PCM has been encoded, returns true when encoder's tail has been written
+    virtual bool drain(void) { return true; }
     virtual std::string id();
+    // offsets (since flush) where decoding can start are moved out, raw formats can start on any block
+    void syncPoints(uint64_t before, std::deque<uint64_t>& points) { encoded->syncs(before, points); }
+    virtual size_t blockAlign(void) { return 0; }
 };
 
-std::unique_ptr<baseCodec> createCodec(codecSettings::type codec, codecSettings settings, bool store = false);
\ No newline at end of file
+std::unique_ptr<baseCodec> createCodec(codecSettings::type codec, codecSettings settings, bool store = false);
+// codec as set in config (e.g. flac:5 or opus:0:10), throws when unknown
+std::unique_ptr<baseCodec> createCodec(const std::string& codec, codecSettings settings, bool store = false);
+// codec string with an encoding cost lowered by steps (when format has a knob for it)
+std::string scaleCodec(const std::string& codec, int steps);
\ No newline at end of file
@@ -62,6 +62,12 @@ void SaveConfig(char *name, void *ref, bool full) {
 	XMLUpdateNode(doc, root, false, "client_id", glClientId);
 	XMLUpdateNode(doc, root, false, "client_secret", glClientSecret);
 	XMLUpdateNode(doc, root, false, "ports", "%hu:%hu", glPortBase, glPortRange);
+	XMLUpdateNode(doc, root, false, "track_cache", "%u:%u", glTrackCacheRAM, glTrackCacheDisk);
+	XMLUpdateNode(doc, root, false, "memory_budget", "%u", glMemoryBudget);
+	XMLUpdateNode(doc, root, false, "encoder_pool", "%u:%u", glEncoderThreads, glEncodeAhead);
+	XMLUpdateNode(doc, root, false, "codec_stats", glCodecStats);
+	XMLUpdateNode(doc, root, false, "exact_length_max", "%u", glExactLengthMax);
+	XMLUpdateNode(doc, root, false, "codec_adapt", "%g:%g", glCodecAdaptDown, glCodecAdaptUp);
 
 	XMLUpdateNode(doc, common, false, "enabled", "%d", (int) glMRConfig.Enabled);
 	XMLUpdateNode(doc, common, false, "max_volume", "%d", glMRConfig.MaxVolume);
@@ -71,6 +77,7 @@ void SaveConfig(char *name, void *ref, bool full) {
 	XMLUpdateNode(doc, common, false, "vorbis_rate", "%d", glMRConfig.VorbisRate);
 	XMLUpdateNode(doc, common, false, "flow", "%d", glMRConfig.Flow);
 	XMLUpdateNode(doc, common, false, "use_filecache", "%d", glMRConfig.CacheMode);
+	XMLUpdateNode(doc, common, false, "pacing", glMRConfig.Pacing);
 	XMLUpdateNode(doc, common, false, "gapless", "%d", glMRConfig.Gapless);
 	XMLUpdateNode(doc, common, false, "artwork", "%s", glMRConfig.ArtWork);
 
@@ -136,6 +143,8 @@ static void LoadConfigItem(tMRConfig *Conf, char *name, char *val) {
 	if (!strcmp(name, "vorbis_rate")) Conf->VorbisRate = atoi(val);
 	if (!strcmp(name, "flow")) Conf->Flow = atoi(val);
 	if (!strcmp(name, "use_filecache")) Conf->CacheMode = atoi(val);
+	if (!strcmp(name, "pacing")) strcpy(Conf->Pacing, val);
+	if (!strcmp(name, "group")) strcpy(Conf->Group, val);
 	if (!strcmp(name, "gapless")) Conf->Gapless = atoi(val);
 	if (!strcmp(name, "artwork")) strcpy(Conf->ArtWork, val);
 	if (!strcmp(name, "credentials")) strcpy(Conf->Credentials, val);
@@ -159,6 +168,12 @@ static void LoadGlobalItem(char *name, char *val) {
 	if (!strcmp(name, "max_players")) glMaxDevices = atol(val);
 	if (!strcmp(name, "interface")) strncpy(glInterface, val, sizeof(glInterface) - 1);
 	if (!strcmp(name, "ports")) sscanf(val, "%hu:%hu", &glPortBase, &glPortRange);
+	if (!strcmp(name, "track_cache")) sscanf(val, "%u:%u", &glTrackCacheRAM, &glTrackCacheDisk);
+	if (!strcmp(name, "memory_budget")) sscanf(val, "%u", &glMemoryBudget);
+	if (!strcmp(name, "encoder_pool")) sscanf(val, "%u:%u", &glEncoderThreads, &glEncodeAhead);
+	if (!strcmp(name, "codec_stats")) strncpy(glCodecStats, val, sizeof(glCodecStats) - 1);
+	if (!strcmp(name, "exact_length_max")) sscanf(val, "%u", &glExactLengthMax);
+	if (!strcmp(name, "codec_adapt")) sscanf(val, "%f:%f", &glCodecAdaptDown, &glCodecAdaptUp);
 	if (!strcmp(name, "credentials")) glCredentials = atol(val);
 	if (!strcmp(name, "credentials_path")) strncpy(glCredentialsPath, val, sizeof(glCredentialsPath) - 1);
 	if (!strcmp(name, "client_id")) strncpy(glClientId, val, sizeof(glClientId) - 1);
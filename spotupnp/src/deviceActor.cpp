@@ -0,0 +1,109 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <chrono>
+
+#include "Logger.h"
+
+#include "deviceActor.h"
+
+static uint64_t now(void) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/****************************************************************************************
+ * Message
+ */
+
+void deviceActor::message::setMetadata(const metadata_t* source) {
+    // pointers are only set when reading as strings move with the message
+    metadata = *source;
+    const char* values[] = { source->artist, source->album, source->title, source->remote_title, source->artwork, source->genre };
+    for (int i = 0; i < 6; i++) if (values[i]) strings[i] = values[i], present |= 1 << i;
+    hasMetadata = true;
+}
+
+metadata_t* deviceActor::message::getMetadata(void) {
+    if (!hasMetadata) return nullptr;
+    const char** values[] = { &metadata.artist, &metadata.album, &metadata.title, &metadata.remote_title, &metadata.artwork, &metadata.genre };
+    for (int i = 0; i < 6; i++) *values[i] = (present & (1 << i)) ? strings[i].c_str() : nullptr;
+    return &metadata;
+}
+
+/****************************************************************************************
+ * Actor
+ */
+
+deviceActor::deviceActor(std::string name, std::function<void(message&)> handler) : handler(handler), name(name) {
+    tail = new node(message(false, 0));
+    head = tail;
+    executor = std::thread(&deviceActor::executorTask, this);
+}
+
+deviceActor::~deviceActor() {
+    stop();
+
+    // discard what has not been executed
+    for (node* next; tail; tail = next) {
+        next = tail->next;
+        delete tail;
+    }
+}
+
+void deviceActor::stop(void) {
+    if (!isRunning.exchange(false)) return;
+
+    // a post that has seen us running is finishing, the next ones will see we are not
+    while (posting) std::this_thread::yield();
+
+    sequence++;
+    sequence.notify_one();
+    if (executor.joinable()) executor.join();
+}
+
+void deviceActor::post(message&& item) {
+    posting++;
+    if (!isRunning) {
+        posting--;
+        return;
+    }
+
+    item.posted = now();
+    auto entry = new node(std::move(item));
+
+    // only one exchange for producers, the link is visible to executor just after
+    head.exchange(entry)->next = entry;
+    sequence++;
+    sequence.notify_one();
+    posting--;
+}
+
+void deviceActor::executorTask(void) {
+    while (isRunning) {
+        uint32_t seen = sequence;
+
+        // sequence is bumped after the link is set, so what is counted in seen can be read
+        for (node* next; isRunning && (next = tail->next) != nullptr; ) {
+            delete tail;
+            tail = next;
+
+            auto& item = tail->item;
+            uint64_t started = now();
+            handler(item);
+
+            uint32_t waited = (started - item.posted) / 1000, ran = (now() - started) / 1000;
+            if (waited + ran > slowLatency) {
+                CSPOT_LOG(info, "[%s] %s event %d waited %u ms and ran for %u ms", name.c_str(),
+                                item.shadow ? "shadow" : "spotify", item.event, waited, ran);
+            } else {
+                CSPOT_LOG(debug, "[%s] %s event %d waited %u ms and ran for %u ms", name.c_str(),
+                                 item.shadow ? "shadow" : "spotify", item.event, waited, ran);
+            }
+        }
+
+        sequence.wait(seen);
+    }
+}
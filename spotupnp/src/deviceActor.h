@@ -0,0 +1,78 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <inttypes.h>
+
+#include "metadata.h"
+
+/****************************************************************************************
+ * Device actor
+ *
+ * Each player owns an actor made of a lock-free queue where any thread can post messages and
+ * of a single executor that runs them in order. Requests between Spotify and shadow (UPnP)
+ * sides are posted instead of called, so that a burst on one side does not wait on the other
+ * side's mutex and the time a message spends in queue can be measured
+ */
+class deviceActor {
+public:
+    struct message {
+        // true when going to shadow player, false when going to Spotify
+        bool shadow = false;
+        int event = 0;
+        // volume, position or offset
+        int64_t value = 0;
+        // url or credentials
+        std::string text;
+        bool hasMetadata = false;
+        uint64_t posted = 0;
+
+        message(bool shadow, int event, int64_t value = 0, std::string text = "") :
+            shadow(shadow), event(event), value(value), text(text) { }
+        void setMetadata(const metadata_t* metadata);
+        metadata_t* getMetadata(void);
+    private:
+        // strings are owned so that sender's ones can go away before execution
+        std::string strings[6];
+        uint8_t present = 0;
+        metadata_t metadata = {};
+    };
+
+private:
+    struct node {
+        message item;
+        std::atomic<node*> next = nullptr;
+        node(message&& item) : item(std::move(item)) { }
+    };
+
+    // producers swap head, executor owns tail which is always an already consumed node
+    std::atomic<node*> head;
+    node* tail;
+    std::atomic<uint32_t> sequence = 0;
+    std::atomic<bool> isRunning = true;
+    // posts in progress, stop waits for them so none touches the queue once it is freed
+    std::atomic<uint32_t> posting = 0;
+    std::function<void(message&)> handler;
+    std::thread executor;
+    std::string name;
+
+    void executorTask(void);
+
+public:
+    // messages waiting longer than that are logged
+    inline static uint32_t slowLatency = 100;
+
+    deviceActor(std::string name, std::function<void(message&)> handler);
+    ~deviceActor();
+    void post(message&& item);
+    void stop(void);
+    bool running(void) { return isRunning; }
+};
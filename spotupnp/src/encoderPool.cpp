@@ -0,0 +1,84 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <algorithm>
+
+#include "Logger.h"
+
+#include "encoderPool.h"
+
+encoderPool::encoderPool(size_t count) {
+    for (size_t i = 0; i < std::max(count, (size_t) 1); i++) workers.emplace_back(&encoderPool::workerTask, this);
+    CSPOT_LOG(info, "encoder pool started with %zu workers", workers.size());
+}
+
+encoderPool::~encoderPool() {
+    {
+        std::scoped_lock lock(mutex);
+        isRunning = false;
+    }
+    cond.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+encoderPool& encoderPool::instance(void) {
+    static encoderPool pool(workerCount);
+    return pool;
+}
+
+void encoderPool::enlist(std::weak_ptr<job> job) {
+    std::scoped_lock lock(mutex);
+    jobs.push_back(job);
+    generation++;
+    cond.notify_one();
+}
+
+void encoderPool::signal(void) {
+    std::scoped_lock lock(mutex);
+    generation++;
+    cond.notify_one();
+}
+
+void encoderPool::workerTask(void) {
+    std::unique_lock lock(mutex);
+
+    while (isRunning) {
+        uint32_t seen = generation;
+        std::vector<std::pair<std::shared_ptr<job>, entry*>> candidates;
+
+        // a job that had nothing to do is ignored until something new happens
+        jobs.remove_if([](auto& item) { return !item.running && item.task.expired(); });
+        for (auto& item : jobs) {
+            if (item.running || item.stalled == generation) continue;
+            if (auto candidate = item.task.lock()) candidates.emplace_back(candidate, &item);
+        }
+
+        std::shared_ptr<job> elected;
+        entry* item = nullptr;
+        for (int urgency, best = 0; auto& [candidate, candidateItem] : candidates) {
+            urgency = candidate->urgency();
+            if (urgency > best || (urgency && urgency == best && candidateItem->elected < item->elected)) {
+                best = urgency, elected = candidate, item = candidateItem;
+            }
+        }
+
+        if (elected) item->running = true, item->elected = ++elections;
+        lock.unlock();
+
+        // last reference to a job might be released here, so not while we are locked
+        candidates.clear();
+        bool done = elected && elected->encode();
+        elected.reset();
+
+        lock.lock();
+        if (item) {
+            item->running = false;
+            if (!done) item->stalled = seen;
+        } else {
+            cond.wait(lock, [&] { return !isRunning || generation != seen; });
+        }
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <list>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <inttypes.h>
+
+/****************************************************************************************
+ * Encoder pool, shared by all players
+ *
+ * Encoding is done by a few workers, away from the thread that provides audio and from the
+ * ones serving HTTP. Each job tells how urgent it is (0 when it has nothing to do) and the 
+ * most urgent gets the next worker, for a slice of work so that others are not starved. When
+ * equally urgent, the one that has waited the longest goes first. A job is never run by two
+ * workers at the same time. Jobs must signal when they might have 
+ * new work, a job that could not do anything is not retried before that
+ */
+class encoderPool {
+public:
+    class job {
+    public:
+        virtual ~job(void) { }
+        virtual int urgency(void) = 0;
+        // returns false when nothing could be done
+        virtual bool encode(void) = 0;
+    };
+
+private:
+    struct entry {
+        std::weak_ptr<encoderPool::job> task;
+        bool running = false;
+        // generation when it last had nothing to do
+        uint32_t stalled = UINT32_MAX;
+        // election when it last ran, to share workers between jobs of same urgency
+        uint64_t elected = 0;
+        entry(std::weak_ptr<encoderPool::job> task) : task(task) { }
+    };
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::list<entry> jobs;
+    std::vector<std::thread> workers;
+    uint32_t generation = 0;
+    uint64_t elections = 0;
+    bool isRunning = true;
+
+    void workerTask(void);
+
+public:
+    inline static size_t workerCount = 2;
+    // seconds of audio encoded ahead of what HTTP has taken (0 = as much as buffers allow)
+    inline static uint32_t ahead = 20;
+
+    encoderPool(size_t workers);
+    ~encoderPool();
+    static encoderPool& instance(void);
+    void enlist(std::weak_ptr<job> job);
+    void signal(void);
+};
@@ -0,0 +1,79 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <vector>
+#include <algorithm>
+
+#include "Logger.h"
+
+#include "memGovernor.h"
+
+memGovernor& memGovernor::instance(void) {
+    static memGovernor governor;
+    return governor;
+}
+
+size_t memGovernor::acquire(const std::string& owner, size_t wanted, size_t minimum) {
+    std::unique_lock lock(mutex);
+
+    if (budget && used + wanted > budget) {
+        // reclaimers might need to call us back, so they are called unlocked
+        std::vector<std::shared_ptr<reclaimable>> candidates;
+        reclaimers.remove_if([](auto& item) { return item.expired(); });
+        for (auto& item : reclaimers) if (auto reclaimer = item.lock()) candidates.push_back(reclaimer);
+        size_t missing = used + wanted - budget;
+        lock.unlock();
+
+        for (auto it = candidates.begin(); missing && it != candidates.end(); ++it) {
+            missing -= std::min(missing, (*it)->reclaim(missing));
+        }
+
+        // last reference to a reclaimer might be released here and it will call us
+        candidates.clear();
+        lock.lock();
+    }
+
+    size_t size = wanted;
+    if (budget && used + wanted > budget) size = std::max(minimum, budget - std::min(used, budget));
+    if (size < wanted) CSPOT_LOG(info, "memory budget short for %s, got %zu kB instead of %zu kB", owner.c_str(), size / 1024, wanted / 1024);
+    // minimums are always granted, so the sum of them can go beyond what was configured
+    if (budget && used + size > budget) CSPOT_LOG(error, "memory budget of %zu kB cannot be met, %s minimum takes it to %zu kB",
+                                                  budget / 1024, owner.c_str(), (used + size) / 1024);
+
+    usage[owner] += size;
+    used += size;
+    return size;
+}
+
+void memGovernor::release(const std::string& owner, size_t size) {
+    std::scoped_lock lock(mutex);
+    auto it = usage.find(owner);
+    if (it == usage.end()) return;
+
+    size = std::min(size, it->second);
+    it->second -= size;
+    used -= size;
+    if (!it->second) usage.erase(it);
+}
+
+void memGovernor::enlist(std::weak_ptr<reclaimable> reclaimer) {
+    std::scoped_lock lock(mutex);
+    reclaimers.remove_if([](auto& item) { return item.expired(); });
+    reclaimers.push_back(reclaimer);
+}
+
+size_t memGovernor::owned(const std::string& owner) {
+    std::scoped_lock lock(mutex);
+    auto it = usage.find(owner);
+    return it != usage.end() ? it->second : 0;
+}
+
+void memGovernor::report(void) {
+    std::scoped_lock lock(mutex);
+    for (auto& [owner, size] : usage) CSPOT_LOG(info, "memory used by %s: %zu kB", owner.empty() ? "<none>" : owner.c_str(), size / 1024);
+    if (budget) CSPOT_LOG(info, "memory used: %zu kB (budget %zu kB)", used / 1024, budget / 1024);
+    else CSPOT_LOG(info, "memory used: %zu kB (no budget)", used / 1024);
+}
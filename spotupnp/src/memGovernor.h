@@ -0,0 +1,48 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <inttypes.h>
+
+/****************************************************************************************
+ * Memory governor, shared by all players
+ *
+ * Buffers ask for the size they would like and get what still fits in the budget, but never
+ * less than their minimum. When short, owners are first asked to give back some memory, idle
+ * ones all they can and active ones what their clients have already been sent. Usage is
+ * accounted per owner (device) so that it can be reported. A budget of 0 means that there is
+ * no limit
+ */
+class memGovernor {
+public:
+    class reclaimable {
+    public:
+        virtual ~reclaimable(void) { }
+        virtual size_t reclaim(size_t wanted) = 0;
+    };
+
+private:
+    std::mutex mutex;
+    std::map<std::string, size_t> usage;
+    std::list<std::weak_ptr<reclaimable>> reclaimers;
+    size_t used = 0;
+
+public:
+    inline static size_t budget = 0;
+
+    static memGovernor& instance(void);
+    size_t acquire(const std::string& owner, size_t wanted, size_t minimum);
+    void release(const std::string& owner, size_t size);
+    void enlist(std::weak_ptr<reclaimable> reclaimer);
+    size_t owned(const std::string& owner);
+    void report(void);
+};
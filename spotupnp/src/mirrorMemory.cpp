@@ -0,0 +1,86 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <atomic>
+#include <string>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "Logger.h"
+
+#include "mirrorMemory.h"
+
+size_t mirrorMemory::granularity(void) {
+#ifndef _WIN32
+    static size_t page = sysconf(_SC_PAGESIZE);
+    return page;
+#else
+    return 1;
+#endif
+}
+
+#ifndef _WIN32
+static int sharedMemory(size_t size) {
+#if defined(__linux__) && defined(SYS_memfd_create)
+    int fd = syscall(SYS_memfd_create, "spotupnp", 0);
+#elif !defined(__linux__)
+    static std::atomic<uint32_t> index;
+    std::string name = "/spotupnp-" + std::to_string(getpid()) + "-" + std::to_string(index++);
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) shm_unlink(name.c_str());
+#else
+    int fd = -1;
+#endif
+    if (fd >= 0 && ftruncate(fd, size) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+#endif
+
+mirrorMemory::mirrorMemory(size_t size) : length(size) {
+#ifndef _WIN32
+    int fd = size % granularity() ? -1 : sharedMemory(size);
+
+    if (fd >= 0) {
+        // reserve the whole address range first, then map the same pages on each half
+        void* area = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (area != MAP_FAILED) {
+            uint8_t* p = (uint8_t*) area;
+            if (mmap(p, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED &&
+                mmap(p + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED) {
+                base = p;
+                mirrored = true;
+            } else {
+                munmap(area, 2 * size);
+            }
+        }
+        // mappings hold a reference
+        close(fd);
+    }
+
+    if (!mirrored) CSPOT_LOG(info, "can't mirror %zu kB buffer, using plain memory", size / 1024);
+#endif
+    if (!base) base = new uint8_t[size];
+}
+
+mirrorMemory::~mirrorMemory(void) {
+#ifndef _WIN32
+    if (mirrored) {
+        munmap(base, 2 * length);
+        return;
+    }
+#endif
+    delete[] base;
+}
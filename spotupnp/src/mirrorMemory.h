@@ -0,0 +1,34 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/****************************************************************************************
+ * Mirrored memory
+ *
+ * The same pages are mapped twice back-to-back so that size bytes starting anywhere in the
+ * first half are contiguous, a ring built on it never has to split a read or a write. When 
+ * the platform can't do it, memory is simply allocated and extent() is only size, so users
+ * must still handle the wrap. Size must be a multiple of granularity()
+ */
+class mirrorMemory {
+private:
+    uint8_t* base = NULL;
+    size_t length;
+    bool mirrored = false;
+
+public:
+    static size_t granularity(void);
+    mirrorMemory(size_t size);
+    ~mirrorMemory(void);
+    uint8_t* data(void) { return base; }
+    size_t size(void) { return length; }
+    // how many bytes can be addressed contiguously from data()
+    size_t extent(void) { return mirrored ? 2 * length : length; }
+};
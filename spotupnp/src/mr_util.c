@@ -124,6 +124,8 @@ struct sMR *GetMaster(struct sMR *Device, char **Name)
 void FlushMRDevices(void) {
 	for (int i = 0; i < glMaxDevices; i++) {
 		struct sMR *p = &glMRDevices[i];
+		// update thread is gone so nobody else creates or deletes players
+		if (p->Running) spotStopPlayer(p->SpotPlayer);
 		pthread_mutex_lock(&p->Mutex);
 		if (p->Running) {
 			// device's mutex returns unlocked
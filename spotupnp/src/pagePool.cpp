@@ -0,0 +1,70 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <new>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "pagePool.h"
+
+static uint8_t* allocate(void) {
+#ifndef _WIN32
+    // straight from the system so that what is freed really goes back to it
+    void* page = mmap(NULL, pagePool::pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return page != MAP_FAILED ? (uint8_t*) page : NULL;
+#else
+    return new (std::nothrow) uint8_t[pagePool::pageSize];
+#endif
+}
+
+static void release(uint8_t* page) {
+#ifndef _WIN32
+    munmap(page, pagePool::pageSize);
+#else
+    delete[] page;
+#endif
+}
+
+pagePool& pagePool::instance(void) {
+    static pagePool pool;
+    return pool;
+}
+
+pagePool::~pagePool(void) {
+    for (auto page : pages) release(page);
+}
+
+uint8_t* pagePool::get(void) {
+    std::unique_lock lock(mutex);
+    inUse++;
+
+    if (!pages.empty()) {
+        uint8_t* page = pages.back();
+        pages.pop_back();
+        return page;
+    }
+
+    // system call is done unlocked
+    lock.unlock();
+    uint8_t* page = allocate();
+    if (!page) inUse--;
+    return page;
+}
+
+void pagePool::put(uint8_t* page) {
+    std::unique_lock lock(mutex);
+    inUse--;
+
+    if (pages.size() * pageSize < spare) {
+        pages.push_back(page);
+        return;
+    }
+
+    lock.unlock();
+    release(page);
+}
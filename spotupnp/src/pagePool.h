@@ -0,0 +1,39 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <inttypes.h>
+#include <stddef.h>
+
+/****************************************************************************************
+ * Page pool, shared by all players
+ *
+ * Cache buffers are made of fixed-size pages taken when data arrives and given back when
+ * they are flushed or shrunk, so memory follows what is actually buffered. A few free pages
+ * are kept for the next taker, others are returned to the system
+ */
+class pagePool {
+private:
+    std::mutex mutex;
+    std::vector<uint8_t*> pages;
+    std::atomic<size_t> inUse = 0;
+
+public:
+    static constexpr size_t pageSize = 64 * 1024;
+    // bytes of free pages kept for re-use
+    inline static size_t spare = 2 * 1024 * 1024;
+
+    static pagePool& instance(void);
+    ~pagePool(void);
+    // returns NULL when system is out of memory
+    uint8_t* get(void);
+    void put(uint8_t* page);
+    size_t used(void) { return inUse * pageSize; }
+};
@@ -0,0 +1,215 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON)
+#define KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+#include "Logger.h"
+
+#include "sampleKernels.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET(isa) __attribute__((target(isa)))
+#else
+#define TARGET(isa)
+#endif
+
+/****************************************************************************************
+ * Scalar, also used for what remains after vectors
+ */
+
+static void widenScalar(const int16_t* src, int32_t* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) dst[i] = src[i];
+}
+
+static void deinterleaveScalar(const int16_t* src, float* left, float* right, size_t frames, float scale) {
+    for (size_t i = 0; i < frames; i++) {
+        left[i] = src[2 * i] * scale;
+        right[i] = src[2 * i + 1] * scale;
+    }
+}
+
+static void byteswapScalar(uint16_t* data, size_t count) {
+    for (size_t i = 0; i < count; i++) data[i] = (data[i] << 8) | (data[i] >> 8);
+}
+
+#ifdef KERNELS_X86
+/****************************************************************************************
+ * SSE2
+ */
+
+TARGET("sse2") static void widenSSE2(const int16_t* src, int32_t* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+        // duplicate each sample in both halves then shift to sign-extend
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+        _mm_storeu_si128((__m128i*) (dst + i + 4), _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+    }
+    widenScalar(src + i, dst + i, count - i);
+}
+
+TARGET("sse2") static void deinterleaveSSE2(const int16_t* src, float* left, float* right, size_t frames, float scale) {
+    __m128 k = _mm_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (src + 2 * i));
+        __m128 lo = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), k);
+        __m128 hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), k);
+        _mm_storeu_ps(left + i, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(right + i, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+    deinterleaveScalar(src + 2 * i, left + i, right + i, frames - i, scale);
+}
+
+TARGET("sse2") static void byteswapSSE2(uint16_t* data, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+        _mm_storeu_si128((__m128i*) (data + i), _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+    }
+    byteswapScalar(data + i, count - i);
+}
+
+/****************************************************************************************
+ * AVX2
+ */
+
+TARGET("avx2") static void widenAVX2(const int16_t* src, int32_t* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (src + i)));
+        _mm256_storeu_si256((__m256i*) (dst + i), v);
+    }
+    widenScalar(src + i, dst + i, count - i);
+}
+
+TARGET("avx2") static void deinterleaveAVX2(const int16_t* src, float* left, float* right, size_t frames, float scale) {
+    __m256 k = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m256 a = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (src + 2 * i)))), k);
+        __m256 b = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (src + 2 * i + 8)))), k);
+        // shuffles stay within 128 bits lanes, so 64 bits pairs must be put back in order
+        __m256 l = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm256_storeu_ps(left + i, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(l), _MM_SHUFFLE(3, 1, 2, 0))));
+        _mm256_storeu_ps(right + i, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r), _MM_SHUFFLE(3, 1, 2, 0))));
+    }
+    deinterleaveScalar(src + 2 * i, left + i, right + i, frames - i, scale);
+}
+
+TARGET("avx2") static void byteswapAVX2(uint16_t* data, size_t count) {
+    const __m256i mask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (data + i));
+        _mm256_storeu_si256((__m256i*) (data + i), _mm256_shuffle_epi8(v, mask));
+    }
+    byteswapScalar(data + i, count - i);
+}
+
+static bool hasSSE2(void) {
+#if defined(__x86_64__) || defined(_M_X64)
+    return true;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return info[3] & (1 << 26);
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool hasAVX2(void) {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    // OS must save ymm registers (OSXSAVE and XCR0 bits 1-2)
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 0x06) != 0x06) return false;
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+#ifdef KERNELS_NEON
+/****************************************************************************************
+ * NEON
+ */
+
+static void widenNEON(const int16_t* src, int32_t* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t v = vld1q_s16(src + i);
+        vst1q_s32(dst + i, vmovl_s16(vget_low_s16(v)));
+        vst1q_s32(dst + i + 4, vmovl_s16(vget_high_s16(v)));
+    }
+    widenScalar(src + i, dst + i, count - i);
+}
+
+static void deinterleaveNEON(const int16_t* src, float* left, float* right, size_t frames, float scale) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        // loads and de-interleaves at once
+        int16x8x2_t v = vld2q_s16(src + 2 * i);
+        vst1q_f32(left + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v.val[0]))), scale));
+        vst1q_f32(left + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v.val[0]))), scale));
+        vst1q_f32(right + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v.val[1]))), scale));
+        vst1q_f32(right + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v.val[1]))), scale));
+    }
+    deinterleaveScalar(src + 2 * i, left + i, right + i, frames - i, scale);
+}
+
+static void byteswapNEON(uint16_t* data, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint8x16_t v = vld1q_u8((const uint8_t*) (data + i));
+        vst1q_u8((uint8_t*) (data + i), vrev16q_u8(v));
+    }
+    byteswapScalar(data + i, count - i);
+}
+#endif
+
+/****************************************************************************************
+ * Selection
+ */
+
+std::vector<sampleKernels> sampleKernels::available(void) {
+    std::vector<sampleKernels> sets = { { "scalar", widenScalar, deinterleaveScalar, byteswapScalar } };
+#if defined(KERNELS_X86)
+    if (hasSSE2()) sets.push_back({ "SSE2", widenSSE2, deinterleaveSSE2, byteswapSSE2 });
+    if (hasAVX2()) sets.push_back({ "AVX2", widenAVX2, deinterleaveAVX2, byteswapAVX2 });
+#elif defined(KERNELS_NEON)
+    sets.push_back({ "NEON", widenNEON, deinterleaveNEON, byteswapNEON });
+#endif
+    return sets;
+}
+
+static sampleKernels choose(void) {
+    // last one is the best
+    sampleKernels kernels = sampleKernels::available().back();
+    CSPOT_LOG(info, "using %s sample conversion", kernels.name);
+    return kernels;
+}
+
+const sampleKernels& sampleKernels::instance(void) {
+    static const sampleKernels kernels = choose();
+    return kernels;
+}
@@ -0,0 +1,34 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <vector>
+#include <inttypes.h>
+#include <stddef.h>
+
+/****************************************************************************************
+ * Sample conversion kernels
+ *
+ * Vectorized versions of the per-sample loops codecs need. The best set for the CPU we run
+ * on is selected once (AVX2 or SSE2 on x86, NEON on ARM when built for it) and falls back to
+ * plain C. Source and destination may be unaligned, they must not overlap except byteswap
+ * that works in-place
+ */
+class sampleKernels {
+public:
+    const char* name;
+    // int16 to int32, count is the number of samples
+    void (*widen)(const int16_t* src, int32_t* dst, size_t count);
+    // interleaved stereo int16 to 2 planes of float multiplied by scale
+    void (*deinterleave)(const int16_t* src, float* left, float* right, size_t frames, float scale);
+    // swap bytes of count 16 bits samples
+    void (*byteswap)(uint16_t* data, size_t count);
+
+    static const sampleKernels& instance(void);
+    // sets this CPU can run, from plain C to the one instance() selects
+    static std::vector<sampleKernels> available(void);
+};
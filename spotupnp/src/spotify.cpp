@@ -9,6 +9,8 @@
 #include <fstream>
 #include <stdarg.h>
 #include <deque>
+#include <atomic>
+#include <thread>
 #include "time.h"
 
 #ifdef BELL_ONLY_CJSON
@@ -25,6 +27,7 @@
 #include "CSpotContext.h"
 #include "LoginBlob.h"
 #include "BellHTTPServer.h"
+#include "BellTask.h"
 #include "BellUtils.h"
 #include "WrappedSemaphore.h"
 #include "protobuf/metadata.pb.h"
@@ -34,6 +37,10 @@ extern "C" {
 }
 
 #include "HTTPstreamer.h"
+#include "trackCache.h"
+#include "memGovernor.h"
+#include "encoderPool.h"
+#include "deviceActor.h"
 #include "spotify.h"
 #include "metadata.h"
 #include "codecs.h"
@@ -93,6 +100,7 @@ private:
     unsigned index = 0;
 
     std::string codec, id;
+    int codecStep = 0;
     std::string clientId, clientSecret;
     struct in_addr addr;
     AudioFormat format;
@@ -104,8 +112,15 @@ private:
     std::deque<std::shared_ptr<HTTPstreamer>> streamers;
     std::shared_ptr<HTTPstreamer> player;
 
+    // snapshot of the streamer being fed, published under playerMutex and read without it by writePCM
+    std::atomic<HTTPstreamer*> feeder = nullptr;
+    std::atomic<int> feeding = 0;
+    std::shared_ptr<HTTPstreamer> feederHold;
+    std::string feederTrack;
+
     bool flow;
     int cacheMode;
+    std::string pacing;
     std::deque<uint32_t> flowMarkers;
     cspot::TrackInfo flowTrackInfo;
     
@@ -113,32 +128,57 @@ private:
     std::shared_ptr<cspot::LoginBlob> blob;
     std::unique_ptr<cspot::SpircHandler> spirc;
 
+    // requests to and from shadow player, keep it last to be created after what it uses
+    deviceActor actor;
+
     size_t writePCM(uint8_t* data, size_t bytes, std::string_view trackId);
     auto postHandler(struct mg_connection* conn);
     void eventHandler(std::unique_ptr<cspot::SpircHandler::Event> event);
     void trackHandler(std::string_view trackUnique);
+    void publishFeeder(bool retire = false);
+    void request(spotEvent event, int64_t value = 0, std::string text = "", metadata_t* metadata = nullptr);
+    void execute(deviceActor::message& item);
+    void adaptCodec(double speed);
     void enableZeroConf(void);
 
     void runTask();
 public:
     inline static std::string username = "", password = "";
+    // realtime factors below/above which encoding gets cheaper/better at next track (0 = never)
+    inline static double adaptDown = 0, adaptUp = 0;
 
     CSpotPlayer(char *clientId, char *clientSecret, char* name, char* id, char *credentials, struct in_addr addr, AudioFormat audio, char* codec, bool flow,
-        int64_t contentLength, int cacheMode, struct shadowPlayer* shadow, pthread_mutex_t* mutex);
+        int64_t contentLength, int cacheMode, char* pacing, struct shadowPlayer* shadow, pthread_mutex_t* mutex);
     ~CSpotPlayer();
     void disconnect(bool abort = false);
+    void post(deviceActor::message&& item) { actor.post(std::move(item)); }
+    void stop(void) { actor.stop(); }
 
-    void friend notify(CSpotPlayer *self, enum shadowEvent event, va_list args);
+    void friend notify(CSpotPlayer *self, deviceActor::message& item);
     bool friend getMetaForUrl(CSpotPlayer* self, const std::string url, metadata_t* metadata);
 };
 
 CSpotPlayer::CSpotPlayer(char *clientId, char* clientSecret, char* name, char* id, char *credentials, struct in_addr addr, AudioFormat format, char* codec, bool flow,
-    int64_t contentLength, int cacheMode, struct shadowPlayer* shadow, pthread_mutex_t* mutex) : bell::Task("playerInstance",
+    int64_t contentLength, int cacheMode, char* pacing, struct shadowPlayer* shadow, pthread_mutex_t* mutex) : bell::Task("playerInstance",
         48 * 1024, 0, 0),
     clientConnected(1), codec(codec), id(id), addr(addr), flow(flow),
     clientId(clientId), clientSecret(clientSecret), name(name), credentials(credentials), format(format), shadow(shadow), 
-    playerMutex(mutex), cacheMode(cacheMode) {
+    playerMutex(mutex), cacheMode(cacheMode), pacing(pacing), 
+    actor(name, [this](deviceActor::message& item) { execute(item); }) {
     this->contentLength = (flow && contentLength == HTTP_CL_REAL) ? HTTP_CL_NONE : contentLength;
+
+#ifdef CONFIG_BELL_NOCODEC
+    // cspot does not decode, we receive Spotify's Ogg Vorbis and can only forward it
+    int rate = format == AudioFormat_OGG_VORBIS_320 ? 320 : (format == AudioFormat_OGG_VORBIS_96 ? 96 : 160);
+    if (this->codec.find("ogg") == std::string::npos) CSPOT_LOG(error, "codec %s not possible without decoder, using ogg", codec);
+    this->codec = "ogg:" + std::to_string(rate);
+#else
+    // passthrough needs cspot to deliver Ogg Vorbis (owner should have checked that already)
+    if (this->codec.find("ogg") != std::string::npos) {
+        CSPOT_LOG(error, "Ogg passthrough requires a build with OGG_PASSTHROUGH, using flac");
+        this->codec = "flac";
+    }
+#endif
 }
 
 CSpotPlayer::~CSpotPlayer() {
@@ -146,6 +186,9 @@ CSpotPlayer::~CSpotPlayer() {
     isRunning = false;
     CSPOT_LOG(info, "player <%s> deletion pending", name.c_str());
 
+    // owner should have done that with spotStopPlayer, before taking the shared mutex
+    actor.stop();
+
     // unlock ourselves as we might be waiting
     clientConnected.give();
 
@@ -168,6 +211,22 @@ size_t CSpotPlayer::writePCM(uint8_t* data, size_t bytes, std::string_view track
     if (flushed) return 0;
 #endif
 
+    /* Fast path when the track has not changed: feed the published streamer without taking the 
+     * playerMutex, so that UPnP callbacks holding it can't stall audio. The control plane withdraws 
+     * that snapshot and waits for us to leave before changing it (see publishFeeder) */
+    feeding++;
+    if (auto streamer = feeder.load(); streamer && trackUnique == feederTrack) {
+#ifdef SMART_FLUSH
+        size_t written = flushed || streamer->feedPCMFrames(data, bytes) ? bytes : 0;
+#else
+        size_t written = streamer->feedPCMFrames(data, bytes) ? bytes : 0;
+#endif
+        feeding--;
+        return written;
+    }
+    feeding--;
+
+    // new track (or nothing to feed), this belongs to the control plane
     std::lock_guard lock(playerMutex);
 
     if (streamTrackUnique != trackUnique) {
@@ -180,6 +239,7 @@ size_t CSpotPlayer::writePCM(uint8_t* data, size_t bytes, std::string_view track
         CSPOT_LOG(info, "trackUniqueId update %s => %s", streamTrackUnique.c_str(), trackUnique.data());
         streamTrackUnique = trackUnique;
         trackHandler(trackUnique);
+        publishFeeder();
     }
 
 #ifdef SMART_FLUSH
@@ -241,8 +301,9 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
     
     // switch current streamer to draining state except in flow mode
     if (!streamers.empty() && !flow) {
-        streamers.front()->state = HTTPstreamer::DRAINING;
+        streamers.front()->drain();
         CSPOT_LOG(info, "draining track %s", streamers.front()->streamId.c_str());
+        adaptCodec(streamers.front()->encodeSpeed());
     }
       
     auto newTrackInfo = spirc->getTrackQueue()->getTrackInfo(trackUnique);
@@ -250,7 +311,7 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
 
     // create a new streamer an run it, unless in flow mode
     if (streamers.empty() || !flow) {
-        auto streamer = std::make_shared<HTTPstreamer>(addr, id, index++, codec, flow, contentLength, cacheMode, 
+        auto streamer = std::make_shared<HTTPstreamer>(addr, id, index++, scaleCodec(codec, codecStep), flow, contentLength, cacheMode, pacing,
                                                        newTrackInfo, trackUnique, streamers.empty() ? -startOffset : 0,
                                                        nullptr, nullptr);
 
@@ -265,13 +326,13 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
         if (flow) flowMarkers.push_front(metadata.duration);
        
         // position is optional, shadow player might use it or not
-        shadowRequest(shadow, SPOT_LOAD, streamer->getStreamUrl().c_str(), &metadata, (uint32_t)-streamer->offset);
+        request(SPOT_LOAD, -streamer->offset, streamer->getStreamUrl(), &metadata);
 
         // play unless already paused
-        if (!isPaused) shadowRequest(shadow, SPOT_PLAY);
+        if (!isPaused) request(SPOT_PLAY);
  
         streamers.push_front(streamer);
-        streamer->startTask();
+        streamer->start();
     } else {
         CSPOT_LOG(info, "flow track of duration %d will start at %u", newTrackInfo.duration, flowMarkers.front());
         player->trackInfo = newTrackInfo;
@@ -279,22 +340,53 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
     }
 }
 
+void CSpotPlayer::publishFeeder(bool retire) {
+    // player's mutex is already locked, withdraw snapshot and wait for writePCM to be done with it
+    feeder = nullptr;
+    while (feeding) std::this_thread::yield();
+    feederHold.reset();
+
+    // data path now only sees new snapshot (if any) which it will take as soon as it is set
+    if (retire || streamers.empty()) return;
+    feederTrack = streamTrackUnique;
+    feederHold = streamers.front();
+    feeder = feederHold.get();
+}
+
+void CSpotPlayer::adaptCodec(double speed) {
+    // speed is seconds of audio encoded per second of work, 0 when unknown or not encoding
+    if (!speed || !adaptDown) return;
+
+    int step = codecStep;
+    if (speed < adaptDown) step++;
+    else if (speed > adaptUp && step) step--;
+
+    // nothing to change or no cheaper setting left
+    auto current = scaleCodec(codec, codecStep), scaled = scaleCodec(codec, step);
+    if (scaled == current) return;
+
+    CSPOT_LOG(info, "encoding at %.1fx realtime, %s from %s to %s", speed, step > codecStep ? "lowering" : "raising", 
+              current.c_str(), scaled.c_str());
+    codecStep = step;
+}
+
  void CSpotPlayer::eventHandler(std::unique_ptr<cspot::SpircHandler::Event> event) {
     switch (event->eventType) {
     case cspot::SpircHandler::EventType::PLAYBACK_START: {
+        // avoid conflicts with data callback
+        std::scoped_lock lock(playerMutex);
 #ifdef SMART_FLUSH
         // when flushed in this mode, ignore first PLAYBACK_START
         if (flushed && streamTrackUnique != player->trackUnique) {
             streamers.clear();
             // make sure we don't falsy detect the re-send of current track
             streamTrackUnique = player->trackUnique;
+            publishFeeder();
             break;
         }
 #endif
-        // avoid conflicts with data callback
-        std::scoped_lock lock(playerMutex);
 
-        shadowRequest(shadow, SPOT_STOP);
+        request(SPOT_STOP);
 
         // memorize position for when track's beginning will be detected
         startOffset = std::get<int>(event->data);
@@ -306,6 +398,7 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
         flowMarkers.clear();
         player.reset();
         playlistEnd = false;
+        publishFeeder();
 
 #ifndef SMART_FLUSH
         // exit flushed state while transferring that to notify
@@ -322,7 +415,7 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
         isPaused = std::get<bool>(event->data);
         CSPOT_LOG(info, isPaused ? "Pause" : "Play");
         if (player || !streamers.empty()) {
-            shadowRequest(shadow, isPaused ? SPOT_PAUSE : SPOT_PLAY);
+            request(isPaused ? SPOT_PAUSE : SPOT_PLAY);
         }
         break;
     }
@@ -331,7 +424,7 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
         CSPOT_LOG(info, "flush");
         flushed = true;
 #ifndef SMART_FLUSH
-        shadowRequest(shadow, SPOT_STOP);
+        request(SPOT_STOP);
 #endif
         break;
     }
@@ -339,7 +432,7 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
     case cspot::SpircHandler::EventType::PREV: {  
         std::scoped_lock lock(playerMutex);
         CSPOT_LOG(info, "next/prev");
-        shadowRequest(shadow, SPOT_STOP);
+        request(SPOT_STOP);
         break;
     }
     case cspot::SpircHandler::EventType::DISC:
@@ -356,6 +449,9 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
             break;
         }
 
+        // data path must not feed pre-seek audio while we flush
+        publishFeeder(true);
+
         // we might not have detected track yet but we don't want to re-detect
         auto streamer = player ? player : streamers.back();
         streamer->flush();
@@ -368,8 +464,9 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
         streamers.push_front(streamer);
         streamTrackUnique = streamer->trackUnique;
         lastPosition = 0;
+        publishFeeder();
         
-        shadowRequest(shadow, SPOT_STOP);
+        request(SPOT_STOP);
 
         // be careful that streamer's offset is negative
         metadata_t metadata = { 0 };
@@ -386,18 +483,18 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
             metadata.duration += streamer->offset;
         }
 
-        shadowRequest(shadow, SPOT_LOAD, streamer->getStreamUrl().c_str(), &metadata, -streamer->offset);
-        if (!isPaused) shadowRequest(shadow, SPOT_PLAY);
+        request(SPOT_LOAD, -streamer->offset, streamer->getStreamUrl(), &metadata);
+        if (!isPaused) request(SPOT_PLAY);
         break;
     }
     case cspot::SpircHandler::EventType::DEPLETED:
         playlistEnd = true;
-        streamers.front()->state = HTTPstreamer::DRAINING;
+        streamers.front()->drain();
         CSPOT_LOG(info, "playlist ended, no track left to play");
         break;
     case cspot::SpircHandler::EventType::VOLUME:
         volume = std::get<int>(event->data);
-        shadowRequest(shadow, SPOT_VOLUME, volume);
+        request(SPOT_VOLUME, volume);
         break;
     case cspot::SpircHandler::EventType::TRACK_INFO: {
         /* We can't use this directly to to set player->trackInfo because with ICY mode, the metadata
@@ -412,17 +509,13 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
     }
 }
 
-// this is called with shared mutex locked
-void notify(CSpotPlayer *self, enum shadowEvent event, va_list args) {
-    // should not happen, but at least trace it
-    if (!self) {
-        CSPOT_LOG(error, "shadow event %d for NULL", event);
-        return;
-    }
+// this is called by actor with shared mutex locked
+void notify(CSpotPlayer *self, deviceActor::message& item) {
+    auto event = item.event;
 
     // volume can be handled at anytime
     if (event == SHADOW_VOLUME) {
-        int volume = va_arg(args, int);
+        int volume = item.value;
         if (self->spirc) self->spirc->setRemoteVolume(volume);
         self->volume = volume;
         return;
@@ -432,7 +525,7 @@ void notify(CSpotPlayer *self, enum shadowEvent event, va_list args) {
     
     switch (event) {
     case SHADOW_TIME: {      
-        uint32_t position = va_arg(args, uint32_t);
+        uint32_t position = item.value;
 
         if (!self->player) return;
 
@@ -466,7 +559,7 @@ void notify(CSpotPlayer *self, enum shadowEvent event, va_list args) {
         break;
     }
     case SHADOW_TRACK: {
-        auto url = std::string(va_arg(args, char*));
+        auto& url = item.text;
 
         // nothing to do if we are already the active player
         if (self->streamers.empty() || (self->player && url.find(self->player->getStreamUrl()) != std::string::npos)) return;    
@@ -475,7 +568,10 @@ void notify(CSpotPlayer *self, enum shadowEvent event, va_list args) {
         while (url.find(self->streamers.back()->getStreamUrl()) == std::string::npos) {
             self->streamers.pop_back();
             // we should NEVER be here
-            if (self->streamers.empty()) return;
+            if (self->streamers.empty()) {
+                self->publishFeeder();
+                return;
+            }
         }
 
         // now we can set current player
@@ -512,13 +608,47 @@ void notify(CSpotPlayer *self, enum shadowEvent event, va_list args) {
     }
 }
 
+void CSpotPlayer::request(spotEvent event, int64_t value, std::string text, metadata_t* metadata) {
+    // executed later by actor, in the order of posting
+    deviceActor::message item(true, event, value, text);
+    if (metadata) item.setMetadata(metadata);
+    actor.post(std::move(item));
+}
+
+void CSpotPlayer::execute(deviceActor::message& item) {
+    // owner stops us before taking that mutex to delete us, so we can wait for it
+    std::lock_guard lock(playerMutex);
+
+    if (!item.shadow) {
+        ::notify(this, item);
+        return;
+    }
+
+    switch (item.event) {
+    case SPOT_LOAD:
+        // position is optional, shadow player might use it or not
+        shadowRequest(shadow, SPOT_LOAD, item.text.c_str(), item.getMetadata(), (uint32_t) item.value);
+        break;
+    case SPOT_VOLUME:
+        shadowRequest(shadow, SPOT_VOLUME, (int) item.value);
+        break;
+    case SPOT_CREDENTIALS:
+        shadowRequest(shadow, SPOT_CREDENTIALS, item.text.c_str());
+        break;
+    default:
+        shadowRequest(shadow, (spotEvent) item.event);
+        break;
+    }
+}
+
 void CSpotPlayer::disconnect(bool abort) {
     // shared playerMutex is already locked
     CSPOT_LOG(info, "Disconnecting %s", name.c_str());
     state = abort ? ABORT : DISCO;
-    shadowRequest(shadow, SPOT_STOP);
+    request(SPOT_STOP);
     streamers.clear();
     player.reset();
+    publishFeeder();
 }
 
 bool getMetaForUrl(CSpotPlayer* self, const std::string url, metadata_t* metadata) {
@@ -600,7 +730,7 @@ void CSpotPlayer::runTask() {
         // Auth successful
         if (ctx->config.authData.size() > 0) {
             // send credentials to owner in case it wants to do something with them
-            shadowRequest(shadow, SPOT_CREDENTIALS, ctx->getCredentialsJson().c_str());
+            request(SPOT_CREDENTIALS, 0, ctx->getCredentialsJson());
 
             spirc = std::make_unique<cspot::SpircHandler>(ctx);
 
@@ -647,31 +777,77 @@ void spotOpen(uint16_t portBase, uint16_t portRange, char *username, char* passw
         bell::setDefaultLogger();
         bell::enableTimestampLogging(true);
     }
-    HTTPstreamer::portBase = portBase;
-    if (portRange) HTTPstreamer::portRange = portRange;
+    HTTPserver::portBase = portBase;
+    if (portRange) HTTPserver::portRange = portRange;
     if (username) CSpotPlayer::username = username;
     if (password) CSpotPlayer::password = password;
 }
 
+void spotTrackCache(uint32_t ramSize, uint32_t diskSize) {
+    // sizes are in MB
+    trackCache::ramBudget = (size_t) ramSize * 1024 * 1024;
+    trackCache::diskBudget = (size_t) diskSize * 1024 * 1024;
+}
+
+void spotMemoryBudget(uint32_t size) {
+    // size is in MB
+    memGovernor::budget = (size_t) size * 1024 * 1024;
+}
+
+void spotEncoderPool(uint32_t threads, uint32_t ahead) {
+    // ahead is in seconds
+    encoderPool::workerCount = threads;
+    encoderPool::ahead = ahead;
+}
+
+void spotCodecStats(char* path) {
+    // empty means no statistics file
+    HTTPstreamer::statsFile = path;
+}
+
+void spotExactLengthMax(uint32_t seconds) {
+    // 0 means that there is no limit
+    HTTPstreamer::exactMax = seconds;
+}
+
+void spotCodecAdapt(float down, float up) {
+    // factors are realtime multiples, upper one defaults to 4 times the lower one
+    CSpotPlayer::adaptDown = down;
+    CSpotPlayer::adaptUp = up ? up : 4 * down;
+}
+
+void spotMaxClients(uint32_t count) {
+    // only grows, virtual group members all pull the same streams
+    size_t current = HTTPstreamer::maxClients;
+    while (count > current && !HTTPstreamer::maxClients.compare_exchange_weak(current, count));
+}
+
 void spotClose(void) {
+    // players are gone, servers can leave the reactor before it is destroyed
+    HTTPserver::closeAll();
     delete bell::bellGlobalLogger;
 }
 
 struct spotPlayer* spotCreatePlayer(char *client_id, char* client_secret, char* name, char *id, char * credentials, struct in_addr addr, int oggRate, 
-                                        char *codec, bool flow, int64_t contentLength, int CacheMode, 
+                                        char *codec, bool flow, int64_t contentLength, int CacheMode, char* pacing,
                                         struct shadowPlayer* shadow, pthread_mutex_t *mutex) {
     AudioFormat format = AudioFormat_OGG_VORBIS_160;
 
     if (oggRate == 320) format = AudioFormat_OGG_VORBIS_320;
     else if (oggRate == 96) format = AudioFormat_OGG_VORBIS_96;
 
-    auto player = new CSpotPlayer(client_id, client_secret, name, id, credentials, addr, format, codec, flow, contentLength, CacheMode, shadow, mutex);
+    auto player = new CSpotPlayer(client_id, client_secret, name, id, credentials, addr, format, codec, flow, contentLength, CacheMode, pacing, shadow, mutex);
     if (player->startTask()) return (struct spotPlayer*) player;
 
     delete player;
     return NULL;
 }
 
+void spotStopPlayer(struct spotPlayer* spotPlayer) {
+    // pending requests are dropped and the one being executed (if any) is finished
+    if (spotPlayer) ((CSpotPlayer*) spotPlayer)->stop();
+}
+
 void spotDeletePlayer(struct spotPlayer* spotPlayer) {
     auto player = (CSpotPlayer*) spotPlayer;
     delete player;
@@ -682,8 +858,32 @@ bool spotGetMetaForUrl(struct spotPlayer* spotPlayer, const char *url, metadata_
  }
 
 void spotNotify(struct spotPlayer* spotPlayer, enum shadowEvent event, ...) {
+    auto player = (CSpotPlayer*) spotPlayer;
+
+    // should not happen, but at least trace it
+    if (!player) {
+        CSPOT_LOG(error, "shadow event %d for NULL", event);
+        return;
+    }
+
+    deviceActor::message item(false, event);
     va_list args;
     va_start(args, event);
-    notify((CSpotPlayer*)spotPlayer, event, args);
+
+    switch (event) {
+    case SHADOW_VOLUME:
+        item.value = va_arg(args, int);
+        break;
+    case SHADOW_TIME:
+        item.value = va_arg(args, uint32_t);
+        break;
+    case SHADOW_TRACK:
+        item.text = va_arg(args, char*);
+        break;
+    default:
+        break;
+    }
+
     va_end(args);
+    player->post(std::move(item));
 }
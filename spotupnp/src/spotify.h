@@ -22,10 +22,12 @@ extern "C" {
 #endif
 
 /* The two sides share a common mutex for accessing player's data. This mutex is always valid for the 
- * duration of this whole application. Note that shadowRequest function expects mutex to be locked but 
- * will lock it if not, for safety. The spotNotify also expects that mutex to be locked but will NOT
- * try to lock as it uses scope_lock and lock_guard for convenience. This also means that spotNotify 
- * can call shadowRequest in return safely, with no risk of deadlock */
+ * duration of this whole application. Requests between sides are not direct calls: spotNotify posts a 
+ * message to the player's actor and so do Spotify's requests for the shadow player. The actor executes 
+ * them one at a time, in posting order, with the mutex locked, which is when shadowRequest is called. So
+ * spotNotify can be called with or without the mutex and shadowRequest always finds it locked. Because 
+ * the actor waits for that mutex, it must be stopped using spotStopPlayer before the owner locks the 
+ * mutex to call spotDeletePlayer */
  
 enum spotEvent{ SPOT_STOP, SPOT_LOAD, SPOT_PLAY, SPOT_PAUSE, SPOT_VOLUME, SPOT_CREDENTIALS };
 enum shadowEvent { SHADOW_NONE, SHADOW_TRACK, SHADOW_PLAY, SHADOW_PAUSE, SHADOW_STOP, SHADOW_NEXT, SHADOW_PREV, SHADOW_TIME, SHADOW_VOLUME };
@@ -36,10 +38,19 @@ struct shadowPlayer;
 void				   shadowRequest(struct shadowPlayer* shadow, enum spotEvent event, ...);
 
 struct spotPlayer* spotCreatePlayer(char *clientId, char*clientSecret, char* name, char* id, char *credentials, struct in_addr addr, int audio, char *codec, bool flow, 
-								    int64_t contentLength, int cacheMode, struct shadowPlayer* shadow, pthread_mutex_t *mutex);
+								    int64_t contentLength, int cacheMode, char* pacing, struct shadowPlayer* shadow, pthread_mutex_t *mutex);
+// must be called without player's mutex before deleting it (which is done with the mutex)
+void spotStopPlayer(struct spotPlayer* spotPlayer);
 void spotDeletePlayer(struct spotPlayer *spotPlayer);
 bool spotGetMetaForUrl(struct spotPlayer* spotPlayer, const char* url, metadata_t* metadata);
 void spotOpen(uint16_t portBase, uint16_t portRange, char* username, char *password);
+void spotTrackCache(uint32_t ramSize, uint32_t diskSize);
+void spotMemoryBudget(uint32_t size);
+void spotEncoderPool(uint32_t threads, uint32_t ahead);
+void spotMaxClients(uint32_t count);
+void spotCodecStats(char* path);
+void spotExactLengthMax(uint32_t seconds);
+void spotCodecAdapt(float down, float up);
 void spotClose(void);
 void spotNotify(struct spotPlayer* spotPlayer, enum shadowEvent event, ...);
 
@@ -53,6 +53,12 @@ UpnpClient_Handle 	glControlPointHandle;
 struct sMR			*glMRDevices;
 int					glMaxDevices = 32;
 uint16_t			glPortBase, glPortRange;
+uint32_t			glTrackCacheRAM, glTrackCacheDisk;
+uint32_t			glMemoryBudget;
+uint32_t			glEncoderThreads = 2, glEncodeAhead = 20;
+char				glCodecStats[STR_LEN];
+uint32_t			glExactLengthMax = 900;
+float				glCodecAdaptDown, glCodecAdaptUp;
 char				glInterface[128] = "?";
 char				glCredentialsPath[STR_LEN];
 bool				glCredentials;
@@ -73,6 +79,8 @@ tMRConfig			glMRConfig = {
 							160,				 // OggRate
 							false,				 // Flow
 							HTTP_CACHE_INFINITE, // CacheMode
+							"",					 // Pacing
+							"",					 // Group
 							true,				 // Gapless
 							HTTP_CL_CHUNKED,	 // HTTPContentLength   
 							true,				 // SendMetaData
@@ -150,7 +158,7 @@ static char usage[] =
 		   "  -D <client_id>	   Spotify Client's id\n"
 		   "  -S <client_secret>   Spotify Client's secret\n"
 		   "  -l                   send continuous audio stream instead of separated tracks\n"
-		   "  -g -3|-2|-1|0|<n>    HTTP content-length mode (-3:chunked(*), -2:if known, -1:none, 0:fixed, <n> your value)\n"
+		   "  -g -3|-2|-1|0|<n>    HTTP content-length mode (-4:exact, -3:chunked(*), -2:if known, -1:none, 0:fixed, <n> your value)\n"
 		   "  -A 0|1|2		       HTTP caching mode (0=memory, 1=memory but claim it's infinite(*), 2=on disk)\n"		
 		   "  -e                   disable gapless\n"
 		   "  -u <version>         set the maximum UPnP version for search (default 1)\n"
@@ -166,7 +174,7 @@ static char usage[] =
 		   "  -d <log>=<level>     set logging level\n"
 	       "                       logs: all|main|util|upnp\n"
 		   "                       level: error|warn|info|debug|sdebug\n"
-		   "  -c mp3[:<rate>]|opus[:<rate>]|vorbis[:rate]|flc[:0..9]|wav|pcm audio format send to player (flac)\n"
+		   "  -c mp3[:<rate>]|opus[:<rate>]|vorbis[:rate]|ogg (passthrough build only)|flc[:0..9]|wav|pcm audio format send to player (flac)\n"
 
 #if LINUX || FREEBSD
 		   "  -z                   daemonize\n"
@@ -212,6 +220,7 @@ static 	void*	MRThread(void *args);
 static 	void*	UpdateThread(void *args);
 static 	bool 	AddMRDevice(struct sMR *Device, char * UDN, IXML_Document *DescDoc,	const char *location);
 static	bool 	isExcluded(char *Model, char *ModelNumber);
+static	void	CheckCodec(char *Codec, char *Owner);
 static bool 	Start(bool cold);
 static bool 	Stop(bool exit);
 
@@ -243,8 +252,8 @@ static void *MRThread(void *args) {
 		p->TrackPoll += elapsed;
 
 		/* Should not request any status update if we are stopped, off or waiting
-		 * for an action to be performed or slave */
-		if (p->Master || (p->SpotState != SPOT_PLAY && p->State == STOPPED) ||
+		 * for an action to be performed or slave/follower */
+		if (p->Master || p->Leader || (p->SpotState != SPOT_PLAY && p->State == STOPPED) ||
 			p->ErrorCount < 0 || p->ErrorCount > MAX_ACTION_ERRORS || p->WaitCookie) goto sleep;
 
 		// do polling as event is broken in many uPNP devices (not synchronously)
@@ -288,6 +297,39 @@ void SetTrackURI(struct sMR* Device, bool Next, const char * StreamUrl, metadata
 	free(url);
 }
 
+/*----------------------------------------------------------------------------*/
+static void GroupRequest(struct sMR* Leader, enum spotEvent event, bool Next, const char* StreamUrl, metadata_t* MetaData) {
+	// replay leader's transport request on followers of a virtual group (leader is locked)
+	for (struct sMR* p = glMRDevices; p < glMRDevices + glMaxDevices; p++) {
+		if (!p->Running || p->Leader != Leader) continue;
+
+		pthread_mutex_lock(&p->Mutex);
+
+		switch (event) {
+		case SPOT_STOP:
+			if (p->SpotState != SPOT_STOP) AVTStop(p);
+			break;
+		case SPOT_LOAD:
+			p->Elapsed = p->ElapsedAccrued = 0;
+			SetTrackURI(p, Next, StreamUrl, MetaData);
+			// gapped track change happens while we are supposed to play
+			if (!Next && p->SpotState == SPOT_PLAY) AVTPlay(p);
+			break;
+		case SPOT_PLAY:
+			if (p->SpotState != SPOT_PLAY) AVTPlay(p);
+			break;
+		case SPOT_PAUSE:
+			if (p->SpotState != SPOT_PAUSE) AVTBasic(p, "Pause");
+			break;
+		default:
+			break;
+		}
+
+		if (event != SPOT_LOAD) p->SpotState = event;
+		pthread_mutex_unlock(&p->Mutex);
+	}
+}
+
 /*----------------------------------------------------------------------------*/
 void shadowRequest(struct shadowPlayer *shadow, enum spotEvent event, ...) {
 	struct sMR *Device = (struct sMR*) shadow;
@@ -323,6 +365,11 @@ void shadowRequest(struct shadowPlayer *shadow, enum spotEvent event, ...) {
 			glUpdated = true;
 			strncpy(Device->Config.Credentials, Credentials, sizeof(Device->Config.Credentials) - 1);
 		}
+
+		// followers of a virtual group need them if they have to take over
+		for (struct sMR* p = glMRDevices; p < glMRDevices + glMaxDevices; p++) {
+			if (p->Running && p->Leader == Device) strncpy(p->Credentials, Credentials, sizeof(p->Credentials) - 1);
+		}
 		break;
 	}
 	case SPOT_STOP:
@@ -332,6 +379,7 @@ void shadowRequest(struct shadowPlayer *shadow, enum spotEvent event, ...) {
 			Device->ExpectStop = true;
 		}
 		Device->SpotState = SPOT_STOP;
+		GroupRequest(Device, SPOT_STOP, false, NULL, NULL);
 		break;
 	case SPOT_LOAD: {
 		char* StreamUrl = va_arg(args, char*);
@@ -345,8 +393,15 @@ void shadowRequest(struct shadowPlayer *shadow, enum spotEvent event, ...) {
 
 		LOG_INFO("[%p]: spotify LOAD request", Device);
 
-		if (Device->SpotState != SPOT_PLAY || Device->Gapless) {
+		// a virtual group is gapless only if all its members are
+		bool Gapless = Device->Gapless;
+		for (struct sMR* p = glMRDevices; p < glMRDevices + glMaxDevices; p++) {
+			if (p->Running && p->Leader == Device) Gapless &= p->Gapless;
+		}
+
+		if (Device->SpotState != SPOT_PLAY || Gapless) {
 			SetTrackURI(Device, Device->SpotState == SPOT_PLAY, StreamUrl, MetaData);
+			GroupRequest(Device, SPOT_LOAD, Device->SpotState == SPOT_PLAY, StreamUrl, MetaData);
 		} else {
 			NFREE(Device->NextStreamUrl);
 			Device->NextStreamUrl = strdup(StreamUrl);
@@ -362,6 +417,7 @@ void shadowRequest(struct shadowPlayer *shadow, enum spotEvent event, ...) {
 		// should we set volume?
 		Device->SpotState = SPOT_PLAY;
 		Device->ExpectStop = false;
+		GroupRequest(Device, SPOT_PLAY, false, NULL, NULL);
 		break;
 	}
 	case SPOT_PAUSE:
@@ -369,6 +425,7 @@ void shadowRequest(struct shadowPlayer *shadow, enum spotEvent event, ...) {
 		LOG_INFO("[%p]: spotify pause request", Device);
 		if (Device->State != PAUSED || Device->ExpectStop) AVTBasic(Device, "Pause");
 		Device->SpotState = event;
+		GroupRequest(Device, SPOT_PAUSE, false, NULL, NULL);
 		break;
 	case SPOT_VOLUME: {
 		// discard echo commands
@@ -393,6 +450,15 @@ void shadowRequest(struct shadowPlayer *shadow, enum spotEvent event, ...) {
 			Device->Volume = Volume * Device->Config.MaxVolume;
 			CtrlSetVolume(Device, Device->Volume + 0.5, Device->seqN++);
 			LOG_INFO("[%p]: Volume[0..100] %d", Device, (int) Device->Volume);
+
+			// followers of a virtual group scale it to their own maximum
+			for (struct sMR* p = glMRDevices; p < glMRDevices + glMaxDevices; p++) {
+				if (!p->Running || p->Leader != Device) continue;
+				pthread_mutex_lock(&p->Mutex);
+				p->Volume = Volume * p->Config.MaxVolume;
+				CtrlSetVolume(p, p->Volume + 0.5, p->seqN++);
+				pthread_mutex_unlock(&p->Mutex);
+			}
 		} else {
 			double Ratio = GroupVolume ? (Volume * Device->Config.MaxVolume) / GroupVolume : 0;
 			
@@ -543,6 +609,8 @@ int ActionHandler(Upnp_EventType EventType, const void *Event, void *Cookie) {
 			p->LastCookie = Cookie;
 			
 			char* r;
+			// group followers (and Sonos slaves) have no Spotify player, their leader reports for them
+			bool Report = p->SpotPlayer != NULL;
 
 			// transport state response
 			if ((r = XMLGetFirstDocumentItem(Result, "CurrentTransportState", true)) != NULL) {
@@ -552,16 +620,17 @@ int ActionHandler(Upnp_EventType EventType, const void *Event, void *Cookie) {
 				} else if (!strcmp(r, "STOPPED") && p->State != STOPPED) {
 					LOG_INFO("[%p]: uPNP stopped", p);
 
-					if (p->SpotState == SPOT_PLAY && !p->ExpectStop && p->NextStreamUrl) {
+					if (Report && p->SpotState == SPOT_PLAY && !p->ExpectStop && p->NextStreamUrl) {
 						metadata_t MetaData = { 0 };
 						if (spotGetMetaForUrl(p->SpotPlayer, p->NextStreamUrl, &MetaData)) {
 							SetTrackURI(p, false, p->NextStreamUrl, &MetaData);
 							AVTPlay(p);
+							GroupRequest(p, SPOT_LOAD, false, p->NextStreamUrl, &MetaData);
 						} else {
 							spotNotify(p->SpotPlayer, SHADOW_STOP);
 						}
 						NFREE(p->NextStreamUrl);
-					} else if (p->SpotState != SPOT_STOP && p->SpotState != SPOT_PAUSE) {
+					} else if (Report && p->SpotState != SPOT_STOP && p->SpotState != SPOT_PAUSE) {
 						// some players (Sonos again...) report a STOPPED state when pause *only* with mp3
 						spotNotify(p->SpotPlayer, SHADOW_STOP);
 					}
@@ -571,11 +640,11 @@ int ActionHandler(Upnp_EventType EventType, const void *Event, void *Cookie) {
 				} else if (!strcmp(r, "PLAYING") && (p->State != PLAYING)) {
 					p->State = PLAYING;
 					LOG_INFO("[%p]: uPNP playing", p);
-					if (p->SpotState != SPOT_PLAY) spotNotify(p->SpotPlayer, SHADOW_PLAY);
+					if (Report && p->SpotState != SPOT_PLAY) spotNotify(p->SpotPlayer, SHADOW_PLAY);
 				} else if (!strcmp(r, "PAUSED_PLAYBACK") && p->State != PAUSED) {
 					p->State = PAUSED;
 					LOG_INFO("[%p]: uPNP pause", p);
-					if (p->SpotState == SPOT_PLAY) spotNotify(p->SpotPlayer, SHADOW_PAUSE);
+					if (Report && p->SpotState == SPOT_PLAY) spotNotify(p->SpotPlayer, SHADOW_PAUSE);
 				}
 
 				free(r);
@@ -606,7 +675,7 @@ int ActionHandler(Upnp_EventType EventType, const void *Event, void *Cookie) {
 							p->ElapsedAccrued = 0;
 						}
 						//spotNotify(p->SpotPlayer, SHADOW_TRACK, r + p->PrefixLength);
-						spotNotify(p->SpotPlayer, SHADOW_TRACK, r);
+						if (Report) spotNotify(p->SpotPlayer, SHADOW_TRACK, r);
 						free(r);
 					}
 				}
@@ -624,7 +693,7 @@ int ActionHandler(Upnp_EventType EventType, const void *Event, void *Cookie) {
 
 					/* Some player seems to send previous' track position (WX) or even backward 
 					 * position so the callee cannot really on just one call */
-					spotNotify(p->SpotPlayer, SHADOW_TIME, (Elapsed + p->ElapsedAccrued) * 1000);
+					if (Report) spotNotify(p->SpotPlayer, SHADOW_TIME, (Elapsed + p->ElapsedAccrued) * 1000);
 					p->Elapsed = Elapsed;
 
 					free(r);
@@ -777,6 +846,80 @@ static void FreeUpdate(void *_Item) {
 	free(Item);
 }
 
+/*----------------------------------------------------------------------------*/
+static struct spotPlayer* CreatePlayer(struct sMR* Device) {
+	char id[6 * 2 + 1] = { 0 };
+	char* Name = Device->Config.Name;
+
+	// a virtual group is the same Spotify device whichever member leads it
+	if (*Device->Config.Group) {
+		sprintf(id, "0000%08x", hash32(Device->Config.Group));
+		Name = Device->Config.Group;
+	} else {
+		for (int i = 0; i < 6; i++) sprintf(id + i * 2, "%02x", Device->Config.mac[i]);
+	}
+
+	return spotCreatePlayer(glClientId, glClientSecret, Name, id, Device->Credentials, glHost, Device->Config.VorbisRate,
+							Device->Config.Codec, Device->Config.Flow, Device->Config.HTTPContentLength,
+							Device->Config.CacheMode, Device->Config.Pacing, (struct shadowPlayer*) Device, &Device->Mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+static bool JoinGroup(struct sMR* Device) {
+	if (!*Device->Config.Group) return false;
+
+	// first member to be up leads the group and owns the only Spotify player
+	for (struct sMR* p = glMRDevices; p < glMRDevices + glMaxDevices; p++) {
+		if (p == Device || !p->Running || !p->SpotPlayer || strcmp(p->Config.Group, Device->Config.Group)) continue;
+
+		unsigned Members = 1;
+		Device->Leader = p;
+		for (struct sMR* q = glMRDevices; q < glMRDevices + glMaxDevices; q++) {
+			if (q->Running && q->Leader == p) Members++;
+		}
+
+		// all members pull the same stream, some players open 2 connections
+		spotMaxClients(2 * Members);
+
+		if (strcasecmp(p->Config.Codec, Device->Config.Codec)) {
+			LOG_WARN("[%p]: %s uses codec %s of group leader, not %s", Device, Device->Config.Name, p->Config.Codec, Device->Config.Codec);
+		}
+
+		LOG_INFO("[%p]: %s joins group %s led by %s (%u members)", Device, Device->Config.Name, Device->Config.Group, p->Config.Name, Members);
+		return true;
+	}
+
+	return false;
+}
+
+/*----------------------------------------------------------------------------*/
+static void LeaveGroup(struct sMR* Device) {
+	struct sMR* Leader = NULL;
+
+	// device is locked and leaving, its followers elect the first of them
+	for (struct sMR* p = glMRDevices; p < glMRDevices + glMaxDevices; p++) {
+		if (!p->Running || p->Leader != Device) continue;
+
+		pthread_mutex_lock(&p->Mutex);
+		if (!Leader) {
+			// if it can't have a player, it is left alone and next follower is tried
+			p->Leader = NULL;
+			p->SpotPlayer = CreatePlayer(p);
+			if (p->SpotPlayer) {
+				Leader = p;
+				LOG_INFO("[%p]: %s now leads group %s", p, p->Config.Name, p->Config.Group);
+			} else {
+				LOG_ERROR("[%p]: cannot create Spotify instance (%s) to lead group %s", p, p->Config.Name, p->Config.Group);
+			}
+		} else {
+			p->Leader = Leader;
+		}
+		pthread_mutex_unlock(&p->Mutex);
+	}
+
+	Device->Leader = NULL;
+}
+
 /*----------------------------------------------------------------------------*/
 static void *UpdateThread(void *args) {
 	while (glMainRunning) {
@@ -802,10 +945,13 @@ static void *UpdateThread(void *args) {
 						// if device does not answer, try to download its DescDoc
 						IXML_Document* DescDoc = NULL;
 						if (UpnpDownloadXmlDoc(Device->DescDocURL, &DescDoc) != UPNP_E_SUCCESS) {
+							// player's requests wait for device's mutex, so stop them before
+							spotStopPlayer(Device->SpotPlayer);
 							pthread_mutex_lock(&Device->Mutex);
 							LOG_INFO("[%p]: removing unresponsive player (%s) with error count %d and timeout %d", Device,
 								      Device->Config.Name, Device->ErrorCount, now - Device->LastSeen);
 							spotDeletePlayer(Device->SpotPlayer);
+							LeaveGroup(Device);
 							// device's mutex returns unlocked
 							DelMRDevice(Device);
 						} else {
@@ -824,10 +970,12 @@ static void *UpdateThread(void *args) {
 				Device = UDN2Device(Update->Data);
 
 				// Multiple bye-bye might be sent
+				if (Device) spotStopPlayer(Device->SpotPlayer);
 				if (!CheckAndLock(Device)) continue;
 
 				LOG_INFO("[%p]: renderer bye-bye: %s", Device, Device->Config.Name);
 				spotDeletePlayer(Device->SpotPlayer);
+				LeaveGroup(Device);
 				// device's mutex returns unlocked
 				DelMRDevice(Device);
 
@@ -878,18 +1026,16 @@ static void *UpdateThread(void *args) {
 							LOG_INFO("[%p]: Sonos %s is now master", Device, Device->Config.Name);
 							pthread_mutex_lock(&Device->Mutex);
 							Device->Master = NULL;
-							char id[6 * 2 + 1] = { 0 };
-							for (int i = 0; i < 6; i++) sprintf(id + i * 2, "%02x", Device->Config.mac[i]);
-							Device->SpotPlayer = spotCreatePlayer(glClientId, glClientSecret, Device->Config.Name, id, Device->Credentials, glHost, Device->Config.VorbisRate,
-																  Device->Config.Codec, Device->Config.Flow, Device->Config.HTTPContentLength, 
-																  Device->Config.CacheMode, (struct shadowPlayer*) Device, &Device->Mutex);
+							if (!JoinGroup(Device)) Device->SpotPlayer = CreatePlayer(Device);
 							pthread_mutex_unlock(&Device->Mutex);
 						} else if (Master && (!Device->Master || Device->Master == Device)) {
+							spotStopPlayer(Device->SpotPlayer);
 							pthread_mutex_lock(&Device->Mutex);
 							LOG_INFO("[%p]: Sonos %s is now slave", Device, Device->Config.Name);
 							Device->Master = Master;
 							spotDeletePlayer(Device->SpotPlayer);
 							Device->SpotPlayer = NULL;
+							LeaveGroup(Device);
 							pthread_mutex_unlock(&Device->Mutex);
 						}
 
@@ -931,13 +1077,9 @@ static void *UpdateThread(void *args) {
 				
 				glUpdated = true;
 			
-				if (AddMRDevice(Device, UDN, DescDoc, Update->Data) && !glDiscovery) {
+				if (AddMRDevice(Device, UDN, DescDoc, Update->Data) && !glDiscovery && !JoinGroup(Device)) {
 					// create a new Spotify Connect device
-					char id[6*2+1] = { 0 };
-					for (int i = 0; i < 6; i++) sprintf(id + i*2, "%02x", Device->Config.mac[i]);
-					Device->SpotPlayer = spotCreatePlayer(glClientId, glClientSecret, Device->Config.Name, id, Device->Credentials, glHost, Device->Config.VorbisRate,
-														  Device->Config.Codec, Device->Config.Flow, Device->Config.HTTPContentLength, 
-														  Device->Config.CacheMode, (struct shadowPlayer*) Device, &Device->Mutex);
+					Device->SpotPlayer = CreatePlayer(Device);
 					if (!Device->SpotPlayer) {
 						LOG_ERROR("[%p]: cannot create Spotify instance (%s)", Device, Device->Config.Name);
 						pthread_mutex_lock(&Device->Mutex);
@@ -1010,6 +1152,24 @@ static void *MainThread(void *args) {
 	return NULL;
 }
 
+/*----------------------------------------------------------------------------*/
+/*----------------------------------------------------------------------------*/
+static void CheckCodec(char* Codec, char* Owner) {
+	/* Ogg passthrough exists only in an OGG_PASSTHROUGH build where cspot does not decode, so
+	 * there it is the only possible codec and in other builds it is not possible at all */
+#ifdef CONFIG_BELL_NOCODEC
+	if (strncasecmp(Codec, "ogg", 3)) {
+		LOG_WARN("%s: codec %s is not possible in an Ogg passthrough build, using ogg", Owner, Codec);
+		strcpy(Codec, "ogg");
+	}
+#else
+	if (!strncasecmp(Codec, "ogg", 3)) {
+		LOG_WARN("%s: codec ogg requires a build with OGG_PASSTHROUGH, using flac", Owner);
+		strcpy(Codec, "flac");
+	}
+#endif
+}
+
 /*----------------------------------------------------------------------------*/
 static bool AddMRDevice(struct sMR* Device, char* UDN, IXML_Document* DescDoc, const char* location) {
 	char* friendlyName = NULL;
@@ -1042,6 +1202,7 @@ static bool AddMRDevice(struct sMR* Device, char* UDN, IXML_Document* DescDoc, c
 	Device->Volume = 0;
 	Device->Actions = NULL;
 	Device->Master = NULL;
+	Device->Leader = NULL;
 	Device->Gapless = false;
 	Device->ErrorCount = 0;
 
@@ -1112,17 +1273,27 @@ static bool AddMRDevice(struct sMR* Device, char* UDN, IXML_Document* DescDoc, c
 	if (!*Device->Config.Name) sprintf(Device->Config.Name, glNameFormat, friendlyName);
 	queue_init(&Device->ActionQueue, false, NULL);
 
+	CheckCodec(Device->Config.Codec, Device->Config.Name);
+
+#ifdef CONFIG_BELL_NOCODEC
+	// there is no other format to offer when we only forward Spotify's data
+	char* Sink = GetProtocolInfo(Device);
+	if (!Sink || !strcasestr(Sink, "audio/ogg")) LOG_WARN("[%p]: no audio/ogg in player's sink list, it might refuse the stream", Device);
+	NFREE(Sink);
+#endif
+
 	char* MimeType;
 	if (!strcasecmp(Device->Config.Codec, "pcm")) MimeType = "audio/L16;rate=44100;channels=2";
 	else if (!strcasecmp(Device->Config.Codec, "wav")) MimeType = "audio/wav";
 	else if (strcasestr(Device->Config.Codec, "mp3")) MimeType = "audio/mepg";
 	else if (strcasestr(Device->Config.Codec, "opus")) MimeType = "audio/ogg";
 	else if (strcasestr(Device->Config.Codec, "vorbis")) MimeType = "audio/ogg";
+	else if (strcasestr(Device->Config.Codec, "ogg")) MimeType = "audio/ogg";
 	else if (strcasestr(Device->Config.Codec, "aac")) MimeType = "audio/aac";
 	else MimeType = "audio/flac";
 
 	// we cheat a bit as we allow cache to pretend to be infinite
-	char* DLNA_ORG = makeDLNA_ORG(Device->Config.Codec, Device->Config.CacheMode != HTTP_CACHE_MEM, Device->Config.Flow);
+	char* DLNA_ORG = makeDLNA_ORG(Device->Config.Codec, Device->Config.CacheMode != HTTP_CACHE_MEM, Device->Config.Flow, *Device->Config.Pacing);
 	sprintf(Device->ProtocolInfo, "http-get:*:%s:%s", MimeType, DLNA_ORG);
 	free(DLNA_ORG);
 
@@ -1237,6 +1408,12 @@ static bool Start(bool cold) {
 
 	// start cspot
 	spotOpen(glPortBase, glPortRange, glUserName, glPassword);
+	spotTrackCache(glTrackCacheRAM, glTrackCacheDisk);
+	spotMemoryBudget(glMemoryBudget);
+	spotEncoderPool(glEncoderThreads, glEncodeAhead);
+	spotCodecStats(glCodecStats);
+	spotExactLengthMax(glExactLengthMax);
+	spotCodecAdapt(glCodecAdaptDown, glCodecAdaptUp);
 
 	LOG_INFO("Binding to %s:%hu", inet_ntoa(glHost), glPort);
 
@@ -1520,6 +1697,9 @@ int main(int argc, char *argv[]) {
 	// potentially overwrite with some cmdline parameters
 	if (!ParseArgs(argc, argv)) exit(1);
 
+	// default codec must be possible with this build (devices are checked when added)
+	CheckCodec(glMRConfig.Codec, "default");
+
 	// make sure port range is correct
 	if (glPortBase && !glPortRange) glPortRange = glMaxDevices*4;
 
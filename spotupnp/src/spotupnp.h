@@ -59,6 +59,8 @@ typedef struct sMRConfig
 	int			VorbisRate;
 	bool		Flow;
 	int			CacheMode;
+	char		Pacing[STR_LEN];
+	char		Group[STR_LEN];
 	bool		Gapless;
 	int64_t		HTTPContentLength;
 	bool		SendMetaData;
@@ -87,6 +89,7 @@ struct sMR {
 	struct sService Service[NB_SRV];
 	struct sAction	*Actions;
 	struct sMR		*Master;
+	struct sMR		*Leader;
 	pthread_mutex_t Mutex;
 	pthread_t 		Thread;
 	double			Volume;		// to avoid int volume being stuck at 0
@@ -106,6 +109,12 @@ extern struct sMR			*glMRDevices;
 extern int					glMaxDevices;
 extern char					glInterface[128];
 extern unsigned short		glPortBase, glPortRange;
+extern uint32_t				glTrackCacheRAM, glTrackCacheDisk;
+extern uint32_t				glMemoryBudget;
+extern uint32_t				glEncoderThreads, glEncodeAhead;
+extern char					glCodecStats[STR_LEN];
+extern uint32_t				glExactLengthMax;
+extern float				glCodecAdaptDown, glCodecAdaptUp;
 extern char					glCredentialsPath[STR_LEN];
 extern bool					glCredentials;
 extern char					glClientId[STR_LEN], glClientSecret[STR_LEN];
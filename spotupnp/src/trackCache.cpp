@@ -0,0 +1,125 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <algorithm>
+
+#include "Logger.h"
+
+#include "trackCache.h"
+#include "pagePool.h"
+
+trackCache::entry::~entry(void) {
+    release();
+    if (file) fclose(file);
+}
+
+void trackCache::entry::release(void) {
+    for (auto page : pages) pagePool::instance().put(page);
+    pages.clear();
+}
+
+trackCache& trackCache::instance(void) {
+    static trackCache cache;
+    return cache;
+}
+
+void trackCache::erase(std::list<entry>::iterator it) {
+    // mutex must be locked
+    if (it->file) diskUsed -= it->size;
+    else ramUsed -= it->size;
+    index.erase(it->key);
+    lru.erase(it);
+}
+
+void trackCache::trim(void) {
+    // mutex must be locked, oldest entries are at the back
+    for (auto it = lru.end(); ramUsed > ramBudget && it != lru.begin();) {
+        auto& entry = *--it;
+        if (entry.file) continue;
+
+        // move to disk if it can fit there, otherwise just drop it
+        bool moved = entry.size <= diskBudget && (entry.file = tmpfile()) != NULL;
+        for (size_t i = 0, written = 0; moved && written < entry.size; i++) {
+            size_t len = std::min(pagePool::pageSize, entry.size - written);
+            moved = fwrite(entry.pages[i], 1, len, entry.file) == len;
+            written += len;
+        }
+
+        if (moved) {
+            ramUsed -= entry.size;
+            diskUsed += entry.size;
+            entry.release();
+            CSPOT_LOG(info, "track cache moved %s to disk (%zu bytes)", entry.key.c_str(), entry.size);
+        } else {
+            if (entry.file) fclose(entry.file);
+            entry.file = NULL;
+            CSPOT_LOG(info, "track cache dropped %s (%zu bytes)", entry.key.c_str(), entry.size);
+            erase(it++);
+        }
+    }
+
+    for (auto it = lru.end(); diskUsed > diskBudget && it != lru.begin();) {
+        if (!(--it)->file) continue;
+        CSPOT_LOG(info, "track cache dropped %s from disk (%zu bytes)", it->key.c_str(), it->size);
+        erase(it++);
+    }
+}
+
+void trackCache::store(std::string key, std::vector<uint8_t*>&& pages, size_t size) {
+    std::scoped_lock lock(mutex);
+    if (auto it = index.find(key); it != index.end()) erase(it->second);
+
+    lru.emplace_front(key, std::move(pages), nullptr, size);
+    index[key] = lru.begin();
+    ramUsed += size;
+    CSPOT_LOG(info, "track cache stored %s (%zu bytes)", key.c_str(), size);
+
+    trim();
+}
+
+void trackCache::store(std::string key, FILE* file, size_t size) {
+    std::scoped_lock lock(mutex);
+    if (size > diskBudget) {
+        CSPOT_LOG(info, "track cache can't keep %s on disk (%zu bytes)", key.c_str(), size);
+        fclose(file);
+        return;
+    }
+
+    if (auto it = index.find(key); it != index.end()) erase(it->second);
+
+    lru.emplace_front(key, std::vector<uint8_t*>(), file, size);
+    index[key] = lru.begin();
+    diskUsed += size;
+    CSPOT_LOG(info, "track cache stored %s on disk (%zu bytes)", key.c_str(), size);
+
+    trim();
+}
+
+bool trackCache::fetch(std::string key, size_t max, std::function<void(const uint8_t*, size_t)> sink) {
+    std::scoped_lock lock(mutex);
+    auto it = index.find(key);
+    if (it == index.end() || it->second->size > max) return false;
+
+    // most recently used goes in front
+    lru.splice(lru.begin(), lru, it->second);
+    auto& entry = lru.front();
+
+    if (!entry.file) {
+        for (size_t i = 0, sent = 0; sent < entry.size; i++) {
+            size_t len = std::min(pagePool::pageSize, entry.size - sent);
+            sink(entry.pages[i], len);
+            sent += len;
+        }
+    } else {
+        uint8_t buffer[64 * 1024];
+        fseek(entry.file, 0, SEEK_SET);
+        // file might be longer than what it holds
+        for (size_t n, left = entry.size; left && (n = fread(buffer, 1, std::min(sizeof(buffer), left), entry.file)) > 0; left -= n) sink(buffer, n);
+    }
+
+    CSPOT_LOG(info, "track cache hit %s (%zu bytes from %s)", key.c_str(), entry.size, entry.file ? "disk" : "memory");
+    return true;
+}
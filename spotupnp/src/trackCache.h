@@ -0,0 +1,60 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <mutex>
+#include <functional>
+#include <cstdio>
+#include <inttypes.h>
+
+/****************************************************************************************
+ * Cache of fully encoded tracks, shared by all players
+ *
+ * Tracks are identified by trackId and codec (including its settings). Most recent ones
+ * stay in memory then they are moved to disk when memory budget is exceeded and finally
+ * dropped when disk budget is exceeded as well (least recently used first). Streamers hand
+ * over the pages or the file of their cache, so storing a track does not copy it
+ */
+class trackCache {
+private:
+    struct entry {
+        std::string key;
+        // pages from the shared pool, or file once on disk
+        std::vector<uint8_t*> pages;
+        FILE* file = NULL;
+        size_t size;
+        entry(std::string key, std::vector<uint8_t*>&& pages, FILE* file, size_t size) : 
+            key(key), pages(std::move(pages)), file(file), size(size) { }
+        entry(const entry&) = delete;
+        ~entry(void);
+        void release(void);
+    };
+
+    std::mutex mutex;
+    std::list<entry> lru;
+    std::map<std::string, std::list<entry>::iterator> index;
+    size_t ramUsed = 0, diskUsed = 0;
+
+    void erase(std::list<entry>::iterator it);
+    void trim(void);
+
+public:
+    inline static size_t ramBudget = 0, diskBudget = 0;
+
+    static trackCache& instance(void);
+    static bool enabled(void) { return ramBudget || diskBudget; }
+    static std::string key(std::string trackId, std::string codec) { return trackId + "/" + codec; }
+    // pages are owned by the cache from now on, they hold size bytes
+    void store(std::string key, std::vector<uint8_t*>&& pages, size_t size);
+    // file is owned by the cache from now on (closed if it does not fit), it holds size bytes from start
+    void store(std::string key, FILE* file, size_t size);
+    bool fetch(std::string key, size_t max, std::function<void(const uint8_t*, size_t)> sink);
+};